@@ -0,0 +1,29 @@
+import numpy as np
+import pandas as pd
+
+
+# load the points and tets exported by st-visualizer with "PHFormat": "binary"
+# points: x, y, z followed by the material values, tets: 4 point indices
+def load_binary(path: str, magic: bytes, dtype: str) -> np.memmap:
+    header = np.fromfile(path, dtype="<u4", count=4)
+    if header[:1].tobytes() != magic:
+        raise ValueError(f"{path} is not a {magic.decode()} file")
+    rows, columns = int(header[2]), int(header[3])
+    return np.memmap(path, dtype=dtype, mode="r", offset=16, shape=(rows, columns))
+
+
+def load_points(path: str) -> np.memmap:
+    return load_binary(path, b"STPP", "<f4")
+
+
+def load_tets(path: str) -> np.memmap:
+    return load_binary(path, b"STPT", "<i4")
+
+
+# same as pd.read_csv(path, header=None) on the csv export
+def load_points_frame(path: str) -> pd.DataFrame:
+    return pd.DataFrame(load_points(path))
+
+
+def load_tets_frame(path: str) -> pd.DataFrame:
+    return pd.DataFrame(load_tets(path))
@@ -0,0 +1,247 @@
+#ifndef ST_VISUALIZER_ALIGNMENT_H
+#define ST_VISUALIZER_ALIGNMENT_H
+
+#include "ImportFunctions.h"
+#include "SpatialIndex.h"
+#include "UtilityFunctions.h"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+using std::vector;
+
+#define ICP_MAX_ITERATIONS 50
+// starting rotations tried for every slice pair, as a section can be placed on the slide at any angle
+#define ICP_INITIAL_ROTATIONS 8
+// correspondences further than this multiple of the median distance are left out of a fit
+#define ICP_TRIM_FACTOR 2.5f
+// spots closer than this multiple of the spot spacing of the target count as overlapping
+#define ICP_OVERLAP_FACTOR 1.0f
+// range of the scale of a similarity transform, sections are cut and mounted at about the same size
+#define ICP_MIN_SCALE 0.5f
+#define ICP_MAX_SCALE 2.0f
+
+// Least squares rigid transform, or similarity transform if scaled, taking the source columns onto the paired
+// target columns. The rotation comes from getSVDRotation, the scale is kept within [ICP_MIN_SCALE, ICP_MAX_SCALE].
+inline Eigen::Affine2f getPairedTransform(const Eigen::Matrix2Xf &source, const Eigen::Matrix2Xf &target, bool scaled)
+{
+    const Eigen::Matrix2f r = getSVDRotation(source, target);
+    const Eigen::Vector2f source_centroid = getCentroid(source);
+    const Eigen::Vector2f target_centroid = getCentroid(target);
+
+    float scale = 1;
+    if (scaled)
+    {
+        const Eigen::Matrix2Xf zero_source = source.colwise() - source_centroid;
+        const Eigen::Matrix2Xf zero_target = target.colwise() - target_centroid;
+        const float spread = zero_source.squaredNorm();
+        // the error is quadratic in the scale, so the clamped scale is the best one in the range
+        if (spread > 0)
+            scale = std::clamp((zero_target.array() * (r * zero_source).array()).sum() / spread, ICP_MIN_SCALE, ICP_MAX_SCALE);
+    }
+
+    Eigen::Affine2f transform = Eigen::Affine2f::Identity();
+    transform.linear() = scale * r;
+    transform.translation() = target_centroid - scale * r * source_centroid;
+    return transform;
+}
+
+// Nearest neighbor indices over the spots of every cluster of a slice, so a spot is matched with the closest spot of
+// its own cluster rather than with the closest spot overall
+class clusterGrids
+{
+public:
+    clusterGrids(const Eigen::Matrix2Xf &pts, const vector<int> &clusters)
+    {
+        for (Eigen::Index i = 0; i < pts.cols(); i++)
+        {
+            const auto [slot, inserted] = slots.try_emplace(clusters[i], static_cast<int>(members.size()));
+            if (inserted)
+                members.emplace_back();
+            members[slot->second].push_back(static_cast<int>(i));
+        }
+        grids.reserve(members.size());
+        for (const vector<int> &indices : members)
+        {
+            grids.emplace_back(pts(Eigen::all, indices));
+        }
+    }
+
+    // Index into the slice of the spot of the cluster closest to q, or -1 if the slice has no spot of the cluster
+    int nearest(const Eigen::Vector2f &q, int cluster) const
+    {
+        const auto slot = slots.find(cluster);
+        if (slot == slots.end())
+            return -1;
+        return members[slot->second][grids[slot->second].nearest(q)];
+    }
+
+private:
+    std::unordered_map<int, int> slots;
+    vector<vector<int>> members;
+    vector<spatialGrid> grids;
+};
+
+// A transform found by ICP, the mean squared distance of its trimmed correspondences and the fraction of the source
+// spots it overlaps with the target
+struct icpResult
+{
+    Eigen::Affine2f transform = Eigen::Affine2f::Identity();
+    float error = std::numeric_limits<float>::max();
+    float overlap = 0;
+
+    // lower is better, a transform has to fit well and cover much of the slice, so a start that only fits a small
+    // part of the spots closely does not win
+    float score() const
+    {
+        return overlap > 0 ? error / (overlap * overlap) : std::numeric_limits<float>::max();
+    }
+};
+
+// Iterative closest point from source onto the points of target_index, starting at initial. Returns the transform
+// with the best score among the iterations, where spots within ICP_OVERLAP_FACTOR * spacing of their match overlap.
+// With clusters, every spot is paired with the closest target spot of the same cluster in target_clusters, and left
+// out if there is none.
+inline icpResult getIcpTransform(const Eigen::Matrix2Xf &source, const spatialGrid &target_index,
+                                 const Eigen::Affine2f &initial, bool scaled, float spacing,
+                                 const vector<int> *source_clusters = nullptr,
+                                 const clusterGrids *target_clusters = nullptr)
+{
+    const Eigen::Matrix2Xf &target = target_index.points();
+    const auto num = source.cols();
+    const float overlap_distance = ICP_OVERLAP_FACTOR * ICP_OVERLAP_FACTOR * spacing * spacing;
+    Eigen::Affine2f transform = initial;
+    // the transform with the best score of its own correspondences
+    icpResult best;
+    best.transform = initial;
+
+    vector<int> matches(num);
+    vector<float> distances(num);
+    vector<float> sorted;
+    vector<int> pairs;
+    Eigen::Matrix2Xf paired_source;
+    Eigen::Matrix2Xf paired_target;
+    for (int iteration = 0; iteration < ICP_MAX_ITERATIONS; iteration++)
+    {
+        const Eigen::Matrix2Xf moved = transform * source;
+        sorted.clear();
+        for (Eigen::Index i = 0; i < num; i++)
+        {
+            matches[i] = source_clusters && target_clusters ? target_clusters->nearest(moved.col(i), (*source_clusters)[i])
+                                                            : target_index.nearest(moved.col(i));
+            if (matches[i] == -1)
+                continue;
+            distances[i] = (target.col(matches[i]) - moved.col(i)).squaredNorm();
+            sorted.push_back(distances[i]);
+        }
+        if (sorted.size() < 3)
+            break;
+
+        // trimmed correspondences, so spots without a counterpart on the other section do not pull the fit
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        const float threshold = ICP_TRIM_FACTOR * ICP_TRIM_FACTOR * sorted[sorted.size() / 2];
+        pairs.clear();
+        double sum = 0;
+        int overlapping = 0;
+        for (int i = 0; i < num; i++)
+        {
+            if (matches[i] == -1)
+                continue;
+            overlapping += distances[i] <= overlap_distance;
+            if (distances[i] > threshold)
+                continue;
+            pairs.push_back(i);
+            sum += distances[i];
+        }
+        if (pairs.size() < 3)
+            break;
+
+        icpResult current;
+        current.transform = transform;
+        current.error = static_cast<float>(sum / static_cast<double>(pairs.size()));
+        current.overlap = static_cast<float>(overlapping) / static_cast<float>(num);
+        const bool converged = best.score() - current.score() <= 1e-6f * best.score();
+        if (current.score() < best.score())
+        {
+            best = current;
+        }
+        if (converged)
+            break;
+
+        paired_source.resize(2, static_cast<Eigen::Index>(pairs.size()));
+        paired_target.resize(2, static_cast<Eigen::Index>(pairs.size()));
+        for (size_t k = 0; k < pairs.size(); k++)
+        {
+            paired_source.col(k) = source.col(pairs[k]);
+            paired_target.col(k) = target.col(matches[pairs[k]]);
+        }
+        transform = getPairedTransform(paired_source, paired_target, scaled);
+    }
+    return best;
+}
+
+// Transforms that take every slice into the frame of the first one. Every slice is aligned to the previous one by
+// ICP from a few starting rotations around the centroids, and the start with the best icpResult::score is kept. The
+// pairs run in parallel and their transforms are chained afterwards. clusters, if given, are the cluster of every
+// spot, and spots are only paired within a cluster.
+inline vector<Eigen::Affine2f> alignSlices(const vector<Eigen::Matrix2Xf> &slices, bool scaled,
+                                           const vector<vector<int>> *clusters = nullptr)
+{
+    vector<Eigen::Affine2f> pairwise(slices.size(), Eigen::Affine2f::Identity());
+    parallelFor(slices.size() > 1 ? slices.size() - 1 : 0, [&](size_t k)
+                {
+        const size_t i = k + 1;
+        const Eigen::Matrix2Xf &source = slices[i];
+        const Eigen::Matrix2Xf &target = slices[i - 1];
+        if (source.cols() < 3 || target.cols() < 3)
+            return;
+        const spatialGrid target_index(target);
+        std::optional<clusterGrids> target_clusters;
+        if (clusters)
+            target_clusters.emplace(target, (*clusters)[i - 1]);
+        const Eigen::Vector2f source_centroid = getCentroid(source);
+        const Eigen::Vector2f target_centroid = getCentroid(target);
+        const float source_spread = (source.colwise() - source_centroid).squaredNorm() / static_cast<float>(source.cols());
+        const float target_spread = (target.colwise() - target_centroid).squaredNorm() / static_cast<float>(target.cols());
+        const float scale = scaled && source_spread > 0 ? std::clamp(std::sqrt(target_spread / source_spread), ICP_MIN_SCALE, ICP_MAX_SCALE) : 1.0f;
+
+        // median distance between neighboring target spots
+        vector<float> neighbor_distances(target.cols());
+        for (Eigen::Index j = 0; j < target.cols(); j++)
+        {
+            neighbor_distances[j] = (target.col(target_index.nearest(target.col(j), static_cast<int>(j))) - target.col(j)).norm();
+        }
+        std::nth_element(neighbor_distances.begin(), neighbor_distances.begin() + neighbor_distances.size() / 2, neighbor_distances.end());
+        const float spacing = neighbor_distances[neighbor_distances.size() / 2];
+
+        float best_score = std::numeric_limits<float>::max();
+        for (int j = 0; j < ICP_INITIAL_ROTATIONS; j++)
+        {
+            Eigen::Affine2f initial = Eigen::Affine2f::Identity();
+            initial.linear() = scale * Eigen::Rotation2Df(2 * pi * static_cast<float>(j) / ICP_INITIAL_ROTATIONS).toRotationMatrix();
+            initial.translation() = target_centroid - initial.linear() * source_centroid;
+            const icpResult result = getIcpTransform(source, target_index, initial, scaled, spacing,
+                                                     clusters ? &(*clusters)[i] : nullptr,
+                                                     target_clusters ? &*target_clusters : nullptr);
+            if (result.score() < best_score)
+            {
+                best_score = result.score();
+                pairwise[i] = result.transform;
+            }
+        } });
+
+    vector<Eigen::Affine2f> transforms(slices.size(), Eigen::Affine2f::Identity());
+    for (size_t i = 1; i < slices.size(); i++)
+    {
+        transforms[i] = transforms[i - 1] * pairwise[i];
+    }
+    return transforms;
+}
+
+#endif //ST_VISUALIZER_ALIGNMENT_H
@@ -1,7 +1,11 @@
 
 #include "Contour2D.h"
+#include "GrowAndCover.h"
 #include "Timing.h"
 
+#include <algorithm>
+#include <limits>
+
 using std::vector;
 using std::pair;
 
@@ -37,9 +41,62 @@ int getMaxPos(const vector<float> &material_values)
     return max_index;
 }
 
+materialArgmax getMaterialArgmax(const vector<vector<float>> &material_values)
+{
+    const size_t num_points = material_values.size();
+    materialArgmax ret;
+    ret.primary.resize(num_points);
+    ret.top.resize(num_points);
+    ret.second.resize(num_points);
+
+    // blocks of points, one pass over the values of each point
+    const size_t block_size = 4096;
+    parallelFor((num_points + block_size - 1) / block_size, [&](size_t block)
+                {
+        const size_t end = std::min(num_points, (block + 1) * block_size);
+        for (size_t i = block * block_size; i < end; i++)
+        {
+            const float *values = material_values[i].data();
+            const size_t num_materials = material_values[i].size();
+            int primary = 0;
+            float top = std::numeric_limits<float>::lowest();
+            float second = std::numeric_limits<float>::lowest();
+            for (size_t j = 0; j < num_materials; j++)
+            {
+                if (values[j] > top)
+                {
+                    second = top;
+                    top = values[j];
+                    primary = static_cast<int>(j);
+                }
+                else if (values[j] > second && values[j] != top)
+                {
+                    second = values[j];
+                }
+            }
+            ret.primary[i] = primary;
+            ret.top[i] = top;
+            ret.second[i] = second;
+        } });
+    return ret;
+}
+
+materialArgmax concatArgmax(const vector<materialArgmax> &slices)
+{
+    materialArgmax ret;
+    for (const materialArgmax &slice : slices)
+    {
+        ret.primary.insert(ret.primary.end(), slice.primary.begin(), slice.primary.end());
+        ret.top.insert(ret.top.end(), slice.top.begin(), slice.top.end());
+        ret.second.insert(ret.second.end(), slice.second.begin(), slice.second.end());
+    }
+    return ret;
+}
+
 contourTriMultiDCStruct contourTriMultiDC(const Eigen::Matrix2Xf &pointIndexToPoint,
                                           const vector<vector<int>> &triangleIndexToCornerIndices,
-                                          const vector<vector<float>> &pointIndexToMaterialValues)
+                                          const vector<vector<float>> &pointIndexToMaterialValues,
+                                          const vector<int> &primaryMaterialIndexByPointIndex)
 {
     // Step 1: Set up a structure to define geometry
     const size_t numberOfTriangles = triangleIndexToCornerIndices.size();
@@ -47,12 +104,19 @@ contourTriMultiDCStruct contourTriMultiDC(const Eigen::Matrix2Xf &pointIndexToPo
     // This is a list of the combinations of edges on a triangle by corner
     const vector<pair<int, int>> triangle_edges = {{0, 1}, {1, 2}, {2, 0}};
 
-    // Primary Material index at each point
-    const vector<int> primaryMaterialIndexByPointIndex = mapVector(pointIndexToMaterialValues, std::function(getMaxPos));
-
     const size_t number_of_points = pointIndexToPoint.cols();
-    vector<vector<int>> endpointIndicesToEdgeIndex(number_of_points, vector<int>(number_of_points, -1));
-    
+    // Neighbors of every point with the index of the edge to them, a point has about six
+    vector<vector<pair<int, int>>> pointIndexToNeighborEdges(number_of_points);
+    auto getEdgeIndex = [&pointIndexToNeighborEdges](int first, int second)
+    {
+        for (const auto &[neighbor, edge]: pointIndexToNeighborEdges[first])
+        {
+            if (neighbor == second)
+                return edge;
+        }
+        return -1;
+    };
+
     vector<pair<int, int>> edgeIndexToEndpointIndices;
     edgeIndexToEndpointIndices.reserve(triangle_edges.size());
     // Stores which face index an edge belongs to
@@ -67,7 +131,8 @@ contourTriMultiDCStruct contourTriMultiDC(const Eigen::Matrix2Xf &pointIndexToPo
             int firstEndpointIndex = triangleIndexToCornerIndices[faceIndex][triangle_edges[triangleSide].first];
             int secondEndpointIndex = triangleIndexToCornerIndices[faceIndex][triangle_edges[triangleSide].second];
 
-            if (endpointIndicesToEdgeIndex[firstEndpointIndex][secondEndpointIndex] == -1) // If the edge doesn't already exist
+            const int existingEdgeIndex = getEdgeIndex(firstEndpointIndex, secondEndpointIndex);
+            if (existingEdgeIndex == -1) // If the edge doesn't already exist
             {
                 const int num_of_edges = edgeIndexToEndpointIndices.size();
 
@@ -75,12 +140,11 @@ contourTriMultiDCStruct contourTriMultiDC(const Eigen::Matrix2Xf &pointIndexToPo
                 edgeIndexToEndpointIndices.push_back({triangleIndexToCornerIndices[faceIndex][cornerPair.first],
                                                       triangleIndexToCornerIndices[faceIndex][cornerPair.second]});
                 edgeIndexToFaceIndices.push_back({static_cast<int>(faceIndex)});
-                endpointIndicesToEdgeIndex[firstEndpointIndex][secondEndpointIndex] = num_of_edges;
-                endpointIndicesToEdgeIndex[secondEndpointIndex][firstEndpointIndex] = num_of_edges;
+                pointIndexToNeighborEdges[firstEndpointIndex].emplace_back(secondEndpointIndex, num_of_edges);
+                pointIndexToNeighborEdges[secondEndpointIndex].emplace_back(firstEndpointIndex, num_of_edges);
             }
             else
             {
-                int existingEdgeIndex = endpointIndicesToEdgeIndex[firstEndpointIndex][secondEndpointIndex];
                 edgeIndexToFaceIndices[existingEdgeIndex].push_back(faceIndex); // Connect it to its other face
             }
         }
@@ -134,7 +198,7 @@ contourTriMultiDCStruct contourTriMultiDC(const Eigen::Matrix2Xf &pointIndexToPo
             triangleMidpoints.reserve(triangle_edges.size());
             for (auto edge : triangle_edges)
             {
-                int endpointIndices = endpointIndicesToEdgeIndex[cornerIndices[edge.first]][cornerIndices[edge.second]];
+                int endpointIndices = getEdgeIndex(cornerIndices[edge.first], cornerIndices[edge.second]);
                 if (edgeIndexToMidPoints[endpointIndices].second)
                     triangleMidpoints.push_back(edgeIndexToMidPoints[endpointIndices].first);
             }
@@ -304,7 +368,11 @@ pair<
                 vector<vector<int>>,
                 vector<int>
         >>
-getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &vals, float shrink)
+getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &vals, const materialArgmax &argmax,
+                   float shrink,
+                   vector<vector<int>> *section_tris,
+                   sectionContour *section_contour,
+                   const pair<Eigen::Vector2f, Eigen::Vector2f> *lattice)
 {
     int nmat = vals[0].size();
     float z = pts.col(0)(2);
@@ -315,9 +383,10 @@ getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &val
     }
 
     std::chrono::steady_clock::time_point start_contour_triangulation = std::chrono::high_resolution_clock::now();
-    auto reg = triangulateMatrix(npts);
     vector<vector<int>> tris;
+    if (!lattice || !triangulateLattice(npts, *lattice, tris))
     {
+        auto reg = triangulateMatrix(npts);
         tris.reserve(reg.numberoftriangles);
         for (int i = 0; i < reg.numberoftriangles; i++)
         {
@@ -327,7 +396,7 @@ getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &val
     std::chrono::steady_clock::time_point end_contour_triangulation = std::chrono::high_resolution_clock::now();
     contour_triangle.push_back(duration_cast<std::chrono::microseconds>(end_contour_triangulation - start_contour_triangulation).count());
 
-    auto res = contourTriMultiDC(npts, tris, vals);
+    auto res = contourTriMultiDC(npts, tris, vals, argmax.primary);
     auto ctrs = getContourAllMats2D(res.verts, res.segs, res.segMats, nmat, shrink);
 
     vector<pair<vector<Eigen::Matrix<float, 3, 1, 0>>, vector<pair<int, int>>>> ctrNewPtsAndSegs;
@@ -359,6 +428,14 @@ getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &val
             fverts.push_back(Eigen::Vector3f({vert(0), vert(1), z}));
         }
     }
+    if (section_tris)
+    {
+        *section_tris = std::move(tris);
+    }
+    if (section_contour)
+    {
+        *section_contour = {std::move(res.verts), std::move(res.segs), std::move(res.segMats), nmat, z};
+    }
     return {ctrNewPtsAndSegs, {fverts, ftris, fmats}};
 }
 
@@ -366,7 +443,11 @@ pair<vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>>,
         vector<tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<int>>>>
 getSectionContoursAll(vector<Eigen::Matrix3Xf> sections,
                       vector<vector<vector<float>>> vals,
-                      float shrink)
+                      const vector<materialArgmax> &argmax,
+                      float shrink,
+                      vector<vector<vector<int>>> *section_tris,
+                      vector<sectionContour> *section_contours,
+                      const vector<pair<Eigen::Vector2f, Eigen::Vector2f>> *lattices)
 {
     vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>> newPointsAndSegs;
     newPointsAndSegs.reserve(sections.size());
@@ -374,13 +455,24 @@ getSectionContoursAll(vector<Eigen::Matrix3Xf> sections,
     vector<tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<int>>> triangleInfo;
     triangleInfo.reserve(sections.size());
 
+    if (section_tris)
+    {
+        section_tris->assign(sections.size(), {});
+    }
+    if (section_contours)
+    {
+        section_contours->assign(sections.size(), {});
+    }
+
     log("Contouring Slices.");
     for (int i = 0; i < sections.size(); i++)
     {
         const auto &pts = sections[i];
         const auto &v = vals[i];
         log("  ", i + 1, "/", sections.size(), " slices");
-        auto contour = getSectionContours(pts, v, shrink);
+        auto contour = getSectionContours(pts, v, argmax[i], shrink, section_tris ? &(*section_tris)[i] : nullptr,
+                                          section_contours ? &(*section_contours)[i] : nullptr,
+                                          lattices ? &(*lattices)[i] : nullptr);
         newPointsAndSegs.push_back(std::move(contour.first));
         triangleInfo.push_back(std::move(contour.second));
     }
@@ -18,6 +18,20 @@ int orientation(const Eigen::Vector2f &a, const Eigen::Vector2f &b);
 
 int getMaxPos(const vector<float> &material_values);
 
+// Per point primary material (first index of the largest value), the largest value and the largest value
+// below it, which is lowest() if all materials are equal. Computed once per dataset, see tsv_return_type.
+struct materialArgmax
+{
+    vector<int> primary;
+    vector<float> top;
+    vector<float> second;
+};
+
+materialArgmax getMaterialArgmax(const vector<vector<float>> &material_values);
+
+// Joins the per slice results in the order of flatten
+materialArgmax concatArgmax(const vector<materialArgmax> &slices);
+
 // getMassPoint
 // Might need work based on input type
 template<unsigned int N>
@@ -58,7 +72,18 @@ struct contourTriMultiDCStruct
 
 contourTriMultiDCStruct contourTriMultiDC(const Eigen::Matrix2Xf &pointIndexToPoint,
                                           const vector<vector<int>> &triangleIndexToCornerIndices,
-                                          const vector<vector<float>> &pointIndexToMaterialValues);
+                                          const vector<vector<float>> &pointIndexToMaterialValues,
+                                          const vector<int> &primaryMaterialIndexByPointIndex);
+
+// The multi material contour of a section before it is split by material, see ContourSimplify.h
+struct sectionContour
+{
+    vector<Eigen::Vector2f> verts;
+    vector<pair<int, int>> segs;
+    vector<pair<int, int>> segMats;
+    int nmat = 0;
+    float z = 0;
+};
 
 inline Eigen::Vector2f perp(const Eigen::Vector2f &a)
 { return {-1 * a[1], a[0]}; }
@@ -174,10 +199,22 @@ pair<
                 vector<vector<int>>,
                 vector<int>
         >>
-getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &vals, float shrink);
-
+getSectionContours(const Eigen::Matrix3Xf &pts, const vector<vector<float>> &vals, const materialArgmax &argmax,
+                   float shrink,
+                   vector<vector<int>> *section_tris = nullptr,
+                   sectionContour *section_contour = nullptr,
+                   const pair<Eigen::Vector2f, Eigen::Vector2f> *lattice = nullptr);
+
+// section_tris, if given, receives the triangle mesh of each section
+// section_contours, if given, receives the unsplit contour of each section
+// lattices, if given, are the {origin, v1} hex grids of the sections, which are then triangulated on the lattice
+// instead of with Triangle where all of their points are on it
 pair<vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>>,
         vector<tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<int>>>>
 getSectionContoursAll(vector<Eigen::Matrix3Xf> sections,
                       vector<vector<vector<float>>> vals,
-                      float shrink);
+                      const vector<materialArgmax> &argmax,
+                      float shrink,
+                      vector<vector<vector<int>>> *section_tris = nullptr,
+                      vector<sectionContour> *section_contours = nullptr,
+                      const vector<pair<Eigen::Vector2f, Eigen::Vector2f>> *lattices = nullptr);
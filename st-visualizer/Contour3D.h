@@ -306,25 +306,15 @@ struct Hash2d
 
 inline tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<pair<int, int>>> contourTetMultiDC(const vector<Eigen::Vector3f> &points_by_index,
                                                                                                      const vector<vector<int>> &tets_by_index,
-                                                                                                     const vector<vector<float>> &vals_by_point_index)
+                                                                                                     const vector<vector<float>> &vals_by_point_index,
+                                                                                                     const vector<int> &primary_material_by_point_index)
 {
     log("Contouring.");
     size_t number_of_materials = vals_by_point_index[0].size();
-    size_t number_of_points = points_by_index.size();
     size_t number_of_tets = tets_by_index.size();
 
     vector<pair<int, int>> corner_combinations = {{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}};
 
-    // get material index at each point
-    vector<int> primary_material_by_point_index;
-    {
-        primary_material_by_point_index.reserve(number_of_points);
-        for (size_t point_index = 0; point_index < points_by_index.size(); point_index++)
-        {
-            primary_material_by_point_index.push_back(getMaxPos(vals_by_point_index[point_index]));
-        }
-    }
-
     // create adj table from edges to faces
 
     Hash2d edge_index_by_endpoint_indices;
@@ -572,12 +562,22 @@ inline Eigen::Vector3f getFaceNorm(const vector<Eigen::Vector3f> &pts)
     return sum;
 }
 
+// GPU ready form of one material's surface: a flat triangle index buffer and one unit normal per vertex,
+// plus the material on the other side of each triangle
+struct renderMesh
+{
+    vector<uint32_t> indices;
+    vector<Eigen::Vector3f> normals;
+    vector<int> neighbors;
+};
+
 inline pair<vector<Eigen::Vector3f>, vector<vector<int>>> getContourByMat3D(
     const vector<Eigen::Vector3f> &verts,
     const vector<vector<int>> &segs,
     const vector<pair<int, int>> &segmats,
     int mat,
-    float shrink)
+    float shrink,
+    renderMesh *render = nullptr)
 {
     // Select segments by target material
     vector<int> first_index_match;
@@ -664,22 +664,75 @@ inline pair<vector<Eigen::Vector3f>, vector<vector<int>>> getContourByMat3D(
         const Eigen::Vector3f faceVector = vertex_normals[i];
         const Eigen::Vector3f normalized = faceVector.normalized();
         new_vertices[i] += shrink * normalized;
+        vertex_normals[i] = normalized;
+    }
+
+    // the segments are triangles by now, see getVolumeContours
+    if (render)
+    {
+        render->indices.clear();
+        render->indices.reserve(revised_new_segments.size() * 3);
+        for (const auto &seg : revised_new_segments)
+        {
+            render->indices.insert(render->indices.end(), seg.begin(), seg.end());
+        }
+        render->normals = std::move(vertex_normals);
+        render->neighbors.clear();
+        render->neighbors.reserve(revised_new_segments.size());
+        for (const int i : first_index_match)
+        {
+            render->neighbors.push_back(segmats[i].second);
+        }
+        for (const int i : second_index_match)
+        {
+            render->neighbors.push_back(segmats[i].first);
+        }
     }
 
     return {new_vertices, revised_new_segments};
 }
 
+// Render buffers of a triangle mesh that did not come out of getContourByMat3D, e.g. a decimated one
+inline renderMesh getRenderMesh(const pair<vector<Eigen::Vector3f>, vector<vector<int>>> &mesh,
+                                const vector<int> &neighbors)
+{
+    const auto &[vertices, faces] = mesh;
+    renderMesh render;
+    render.normals.assign(vertices.size(), {0, 0, 0});
+    render.indices.reserve(faces.size() * 3);
+    for (const auto &face : faces)
+    {
+        const Eigen::Vector3f nm = getFaceNorm(subset(vertices, face));
+        for (const int index : face)
+        {
+            render.normals[index] += nm;
+            render.indices.push_back(index);
+        }
+    }
+    for (Eigen::Vector3f &normal : render.normals)
+    {
+        normal = normal.normalized();
+    }
+    render.neighbors = neighbors;
+    return render;
+}
+
 inline vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> getContourAllMats3D(
     const vector<Eigen::Vector3f> &verts,
     const vector<vector<int>> &segs,
     const vector<pair<int, int>> &segmats,
     const int &number_of_materials,
-    const float &shrink)
+    const float &shrink,
+    vector<renderMesh> *render = nullptr)
 {
-    vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> a;
-    for (int i = 0; i < number_of_materials; i++)
+    vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> a(number_of_materials);
+    if (render)
     {
-        a.push_back(getContourByMat3D(verts, segs, segmats, i, shrink));
+        render->assign(number_of_materials, {});
     }
+    // the materials only read the shared contour, so they are extracted in parallel
+    parallelFor(number_of_materials, [&](size_t i)
+                { a[i] = getContourByMat3D(verts, segs, segmats, static_cast<int>(i), shrink,
+                                           render ? &(*render)[i] : nullptr); });
     return a;
 }
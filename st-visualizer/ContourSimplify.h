@@ -0,0 +1,355 @@
+#ifndef ST_VISUALIZER_CONTOURSIMPLIFY_H
+#define ST_VISUALIZER_CONTOURSIMPLIFY_H
+
+#include "Contour2D.h"
+#include "UtilityFunctions.h"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using std::pair;
+using std::string;
+using std::vector;
+
+// a closed loop always keeps at least this many vertices so it does not collapse
+#define CONTOUR_MIN_LOOP_VERTICES 3
+
+// A maximal run of segments between two junctions, or a closed loop (first vertex == last vertex).
+// flipped[i] is set if segment segs[i] runs against the chain, i.e. from verts[i + 1] to verts[i].
+struct contourChain
+{
+    vector<int> verts;
+    vector<int> segs;
+    vector<bool> flipped;
+};
+
+// Splits the contour graph into chains. A vertex is a junction if it does not have exactly two segments,
+// or if its two segments separate different material pairs, so the points where three or more materials
+// meet, and the ends at the hull, are never moved or removed.
+inline vector<contourChain> chainSegments(size_t num_verts, const vector<pair<int, int>> &segs,
+                                          const vector<pair<int, int>> &seg_mats)
+{
+    auto get_mats = [&seg_mats](int seg)
+    {
+        return std::minmax(seg_mats[seg].first, seg_mats[seg].second);
+    };
+
+    // incident segments of every vertex, in compressed rows
+    vector<int> offsets(num_verts + 1, 0);
+    for (const auto &seg : segs)
+    {
+        offsets[seg.first + 1]++;
+        offsets[seg.second + 1]++;
+    }
+    for (size_t v = 0; v < num_verts; v++)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<int> incident(offsets.back());
+    {
+        vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for (int i = 0; i < segs.size(); i++)
+        {
+            incident[fill[segs[i].first]++] = i;
+            incident[fill[segs[i].second]++] = i;
+        }
+    }
+
+    vector<bool> junction(num_verts, false);
+    for (size_t v = 0; v < num_verts; v++)
+    {
+        const int degree = offsets[v + 1] - offsets[v];
+        junction[v] = degree != 2 || get_mats(incident[offsets[v]]) != get_mats(incident[offsets[v] + 1]);
+    }
+
+    vector<contourChain> chains;
+    vector<bool> used(segs.size(), false);
+    auto walk = [&](int start, int seg)
+    {
+        contourChain chain;
+        chain.verts.push_back(start);
+        int current = start;
+        while (true)
+        {
+            used[seg] = true;
+            const bool flipped = segs[seg].first != current;
+            current = flipped ? segs[seg].first : segs[seg].second;
+            chain.verts.push_back(current);
+            chain.segs.push_back(seg);
+            chain.flipped.push_back(flipped);
+            if (junction[current] || current == start)
+                break;
+
+            // a vertex inside a chain has exactly two segments
+            const int next = incident[offsets[current]] == seg ? incident[offsets[current] + 1] : incident[offsets[current]];
+            if (used[next])
+                break;
+            seg = next;
+        }
+        chains.push_back(std::move(chain));
+    };
+
+    for (int v = 0; v < num_verts; v++)
+    {
+        if (!junction[v])
+            continue;
+        for (int k = offsets[v]; k < offsets[v + 1]; k++)
+        {
+            if (!used[incident[k]])
+                walk(v, incident[k]);
+        }
+    }
+    // what is left are loops without any junction
+    for (int i = 0; i < segs.size(); i++)
+    {
+        if (!used[i])
+            walk(segs[i].first, i);
+    }
+    return chains;
+}
+
+inline float distanceToSegment(const Eigen::Vector2f &p, const Eigen::Vector2f &a, const Eigen::Vector2f &b)
+{
+    const Eigen::Vector2f ab = b - a;
+    const float length = ab.squaredNorm();
+    if (length == 0.0f)
+        return (p - a).norm();
+    const float t = std::clamp((p - a).dot(ab) / length, 0.0f, 1.0f);
+    return (p - (a + t * ab)).norm();
+}
+
+// Douglas-Peucker on points[first..last], sets keep for the vertices that stay
+inline void douglasPeucker(const vector<Eigen::Vector2f> &points, int first, int last, float tolerance,
+                           vector<bool> &keep)
+{
+    vector<pair<int, int>> stack = {{first, last}};
+    while (!stack.empty())
+    {
+        const auto [a, b] = stack.back();
+        stack.pop_back();
+        float max_distance = -1;
+        int farthest = -1;
+        for (int i = a + 1; i < b; i++)
+        {
+            const float distance = distanceToSegment(points[i], points[a], points[b]);
+            if (distance > max_distance)
+            {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+        if (farthest != -1 && max_distance > tolerance)
+        {
+            keep[farthest] = true;
+            stack.emplace_back(a, farthest);
+            stack.emplace_back(farthest, b);
+        }
+    }
+}
+
+// Visvalingam-Whyatt on the whole chain: repeatedly drops the interior vertex spanning the smallest triangle,
+// as long as that area is below tolerance^2. The end points are kept.
+inline void visvalingam(const vector<Eigen::Vector2f> &points, float tolerance, size_t min_vertices,
+                        vector<bool> &keep)
+{
+    const int n = static_cast<int>(points.size());
+    vector<int> prev(n);
+    vector<int> next(n);
+    for (int i = 0; i < n; i++)
+    {
+        prev[i] = i - 1;
+        next[i] = i + 1;
+    }
+    auto get_area = [&](int i)
+    {
+        const Eigen::Vector2f u = points[prev[i]] - points[i];
+        const Eigen::Vector2f v = points[next[i]] - points[i];
+        return std::abs(u(0) * v(1) - u(1) * v(0)) / 2;
+    };
+
+    // entries are (area, vertex, version), outdated versions are skipped when popped
+    using entry = std::tuple<float, int, int>;
+    std::priority_queue<entry, vector<entry>, std::greater<>> queue;
+    vector<int> version(n, 0);
+    for (int i = 1; i + 1 < n; i++)
+    {
+        queue.emplace(get_area(i), i, 0);
+    }
+
+    const float max_area = tolerance * tolerance;
+    size_t remaining = n;
+    while (!queue.empty() && remaining > min_vertices)
+    {
+        const auto [area, i, stamp] = queue.top();
+        queue.pop();
+        if (stamp != version[i] || !keep[i])
+            continue;
+        if (area >= max_area)
+            break;
+
+        keep[i] = false;
+        remaining--;
+        next[prev[i]] = next[i];
+        prev[next[i]] = prev[i];
+        for (const int j : {prev[i], next[i]})
+        {
+            if (j > 0 && j + 1 < n)
+            {
+                // an area never drops below the one just removed, which keeps the removal order monotone
+                queue.emplace(std::max(area, get_area(j)), j, ++version[j]);
+            }
+        }
+    }
+}
+
+// Returns which vertices of the chain are kept at the given tolerance, method is "dp" or "visvalingam"
+inline vector<bool> simplifyChain(const vector<Eigen::Vector2f> &points, float tolerance, const string &method)
+{
+    const int n = static_cast<int>(points.size());
+    vector<bool> keep(n, method == "visvalingam");
+    keep.front() = true;
+    keep.back() = true;
+    // loops, including chains that start and end at the same junction, are anchored at the point farthest
+    // from the start so both halves have a proper base line
+    const bool closed = points.front() == points.back();
+
+    if (method == "visvalingam")
+    {
+        visvalingam(points, tolerance, closed ? CONTOUR_MIN_LOOP_VERTICES + 1 : 2, keep);
+        return keep;
+    }
+
+    if (!closed)
+    {
+        douglasPeucker(points, 0, n - 1, tolerance, keep);
+        return keep;
+    }
+
+    int farthest = 0;
+    for (int i = 1; i < n - 1; i++)
+    {
+        if ((points[i] - points[0]).squaredNorm() > (points[farthest] - points[0]).squaredNorm())
+            farthest = i;
+    }
+    if (farthest == 0)
+        return keep;
+    keep[farthest] = true;
+    douglasPeucker(points, 0, farthest, tolerance, keep);
+    douglasPeucker(points, farthest, n - 1, tolerance, keep);
+
+    // a loop that is smaller than the tolerance still keeps a triangle
+    if (std::count(keep.begin(), keep.end() - 1, true) < CONTOUR_MIN_LOOP_VERTICES)
+    {
+        int third = -1;
+        float max_distance = -1;
+        for (int i = 1; i < n - 1; i++)
+        {
+            const float distance = distanceToSegment(points[i], points[0], points[farthest]);
+            if (!keep[i] && distance > max_distance)
+            {
+                max_distance = distance;
+                third = i;
+            }
+        }
+        if (third != -1)
+            keep[third] = true;
+    }
+    return keep;
+}
+
+// Simplified copy of a section contour. Each chain keeps its end points and the material pair of its segments,
+// so both materials along a shared boundary get the same simplified curve.
+inline sectionContour simplifySectionContour(const sectionContour &section, const vector<contourChain> &chains,
+                                             float tolerance, const string &method)
+{
+    sectionContour result;
+    result.nmat = section.nmat;
+    result.z = section.z;
+
+    vector<int> new_index(section.verts.size(), -1);
+    auto get_index = [&](int v)
+    {
+        if (new_index[v] == -1)
+        {
+            new_index[v] = static_cast<int>(result.verts.size());
+            result.verts.push_back(section.verts[v]);
+        }
+        return new_index[v];
+    };
+
+    vector<Eigen::Vector2f> points;
+    for (const contourChain &chain : chains)
+    {
+        points.clear();
+        for (const int v : chain.verts)
+        {
+            points.push_back(section.verts[v]);
+        }
+        const vector<bool> keep = simplifyChain(points, tolerance, method);
+
+        // all segments of a chain separate the same two materials, the first one gives the side
+        const pair<int, int> mats = section.segMats[chain.segs[0]];
+        const bool flipped = chain.flipped[0];
+        int last = get_index(chain.verts[0]);
+        for (size_t i = 1; i < chain.verts.size(); i++)
+        {
+            if (!keep[i])
+                continue;
+            const int current = get_index(chain.verts[i]);
+            result.segs.emplace_back(flipped ? current : last, flipped ? last : current);
+            result.segMats.push_back(mats);
+            last = current;
+        }
+    }
+    return result;
+}
+
+// Levels of detail of the section contours, level i is simplified with tolerances[i] (in data units).
+// The sections are processed in parallel, every level is simplified from the full contour.
+// Returns [level][section][material] contours in the layout of getSectionContoursAll.
+inline vector<vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>>>
+getSectionContourLODs(const vector<sectionContour> &sections, const vector<float> &tolerances,
+                      const string &method, float shrink)
+{
+    if (method != "dp" && method != "visvalingam")
+    {
+        throw std::runtime_error("Unsupported contour simplification: " + method);
+    }
+
+    vector<vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>>> levels(
+        tolerances.size(), vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>>(sections.size()));
+
+    parallelFor(sections.size(), [&](size_t i)
+                {
+        const sectionContour &section = sections[i];
+        const vector<contourChain> chains = chainSegments(section.verts.size(), section.segs, section.segMats);
+        for (size_t level = 0; level < tolerances.size(); level++)
+        {
+            const sectionContour simplified = simplifySectionContour(section, chains, tolerances[level], method);
+            const auto ctrs = getContourAllMats2D(simplified.verts, simplified.segs, simplified.segMats,
+                                                  simplified.nmat, shrink);
+            auto &target = levels[level][i];
+            target.reserve(ctrs.size());
+            for (const auto &[verts, segs] : ctrs)
+            {
+                vector<Eigen::Vector3f> lifted;
+                lifted.reserve(verts.size());
+                for (const Eigen::Vector2f &vert : verts)
+                {
+                    lifted.emplace_back(vert(0), vert(1), simplified.z);
+                }
+                target.emplace_back(std::move(lifted), segs);
+            }
+        } });
+
+    return levels;
+}
+
+#endif //ST_VISUALIZER_CONTOURSIMPLIFY_H
@@ -1,9 +1,11 @@
 
 #include "GrowAndCover.h"
 
-#include <map>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
 
-using std::map;
 using std::pair;
 using std::vector;
 
@@ -16,34 +18,45 @@ Eigen::Rotation2Df rotM(float a)
 // ReSharper disable once CppInconsistentNaming
 Eigen::Rotation2D hexM = rotM(pi / 3);
 
+latticeCoords getLatticeCoords(const Eigen::Matrix2Xf &pts, const Eigen::Vector2f &origin, const Eigen::Vector2f &v1,
+								const Eigen::Vector2f &v2)
+{
+	Eigen::Matrix2f basis;
+	basis << v1, v2;
+	const Eigen::Matrix2f inverse = basis.inverse();
+
+	latticeCoords result;
+	const Eigen::Matrix2Xf offsets = pts.colwise() - origin;
+	result.coords = (inverse * offsets).array().round().cast<int>().matrix();
+	result.residuals = (offsets - basis * result.coords.cast<float>()).colwise().squaredNorm().transpose();
+	return result;
+}
+
 // Pull out all the points which lie on the grid. Only works in hex space.
 // v2 is pi/3 radians from v1 counterclockwise with the same magnitude.
 std::pair<std::vector<int>, Eigen::Matrix2Xi> getInliers(const Eigen::Matrix2Xf &pts, const Eigen::Vector2f &origin,
 														 const Eigen::Vector2f &v1)
 {
 	const Eigen::Vector2f v2 = hexM * v1;
-	Eigen::Matrix2Xi int_coords = roundPtsToCoords(pts, origin, v1, v2);
+	const latticeCoords lattice = getLatticeCoords(pts, origin, v1, v2);
 	const float errorMargin = HEX_ROUNDING_ERROR * v1.norm();
 
 	// Check which indices are within the appropriate bounds
+	const Eigen::Array<bool, Eigen::Dynamic, 1> inliers = lattice.residuals.array() < errorMargin * errorMargin;
 	std::vector<int> indices;
-	indices.reserve(pts.cols());
+	indices.reserve(inliers.count());
 	for (int i = 0; i < pts.cols(); i++)
 	{
-		const auto &pt = pts.col(i);
-		Eigen::Vector2f returnPt = getPoint(int_coords.col(i).cast<float>(), origin, v1, v2);
-
-		const float realMargin = (pt - returnPt).norm();
-		if (realMargin < errorMargin)
+		if (inliers(i))
 		{
 			indices.push_back(i);
 		}
 	}
 
-	Eigen::Matrix2Xi revisedCoords = Eigen::Matrix2Xi::Zero(2, static_cast<int>(indices.size()));
+	Eigen::Matrix2Xi revisedCoords(2, static_cast<int>(indices.size()));
 	for (size_t i = 0; i < indices.size(); i++)
 	{
-		revisedCoords.col(i) = int_coords.col(indices[i]);
+		revisedCoords.col(i) = lattice.coords.col(indices[i]);
 	}
 
 	return {indices, revisedCoords};
@@ -51,59 +64,79 @@ std::pair<std::vector<int>, Eigen::Matrix2Xi> getInliers(const Eigen::Matrix2Xf
 
 Eigen::Matrix2Xi roundPtsToCoords(const Eigen::Matrix2Xf &pts, const Eigen::Vector2f &origin, const Eigen::Vector2f &v1, const Eigen::Vector2f &v2)
 {
-	Eigen::Matrix2Xi coords = Eigen::Matrix2Xi::Zero(2, pts.cols());
-	for (long long i = 0; i < pts.cols(); i++)
-	{
-		coords.col(i) = roundPtToCoord(pts.col(i), origin, v1, v2);
-	}
-	return coords;
+	return getLatticeCoords(pts, origin, v1, v2).coords;
 }
 
 // returns {best origin, best v1},resulting inliers
 pair<pair<Eigen::Vector2f, Eigen::Vector2f>, pair<vector<int>, Eigen::Matrix2Xi>> initGridInliers(
-	const Eigen::Matrix2Xf &pts, const int &num)
+	const Eigen::Matrix2Xf &pts, const spatialGrid &index, const int &num, const unsigned &seed, const float &confidence)
 {
 	if (pts.cols() < 2)
 		throw "Need more points to test";
 
-	std::pair<std::vector<int>, Eigen::Matrix2Xi> best_inliers;
-	Eigen::Vector2f best_origin({0, 0});
-	Eigen::Vector2f best_v1({1, 0});
-
-	for (int i = 0; i < num; i++)
+	// The hypotheses are tested in parallel. Each one draws from its own stream seeded by (seed, hypothesis),
+	// so the result only depends on the seed and not on the thread count.
+	vector<size_t> num_inliers(std::max(num, 0), 0);
+	vector<Eigen::Vector2f> origins(num_inliers.size());
+	vector<Eigen::Vector2f> v1s(num_inliers.size());
+	auto test_hypothesis = [&](size_t i)
 	{
+		std::seed_seq seq{seed, static_cast<unsigned>(i)};
+		std::mt19937 rng(seq);
+
 		// Pick a random point
-		const long long origin_index = rand() % pts.cols();
+		const long long origin_index = rng() % pts.cols();
 		Eigen::Vector2f rand_ori = pts.col(origin_index);
 
 		// Get the next closest point
-		Eigen::Matrix2Xf adjusted_points = pts.colwise() - rand_ori;
-		int selected_point = origin_index > 0 ? 0 : 1;
-
-		float min_norm = adjusted_points.col(selected_point).norm();
-		for (int j = 0; j < adjusted_points.cols(); j++)
-		{
-			const float test_norm = adjusted_points.col(j).norm();
-			if (j != origin_index && test_norm < min_norm)
-			{
-				selected_point = j;
-				min_norm = test_norm;
-			}
-		}
-
-		const Eigen::Vector2f v1 = adjusted_points.col(selected_point);
+		const int selected_point = index.nearest(rand_ori, static_cast<int>(origin_index));
+		const Eigen::Vector2f v1 = pts.col(selected_point) - rand_ori;
 
 		// See how many inliers there are with the resulting grid
-		auto inliers = getInliers(pts, rand_ori, v1);
-
-		// If it's a better fit, save it
-		if (inliers.first.size() > best_inliers.first.size())
+		num_inliers[i] = getInliers(pts, rand_ori, v1).first.size();
+		origins[i] = rand_ori;
+		v1s[i] = v1;
+	};
+
+	// With a confidence target the hypotheses run in batches of a fixed size until a hypothesis drawn from
+	// two inliers (the origin and its neighbor) has been seen with that probability, num stays the cap.
+	// The batches do not depend on the thread count either.
+	size_t tested = num_inliers.size();
+	if (confidence > 0 && confidence < 1)
+	{
+		tested = 0;
+		size_t best_count = 0;
+		while (tested < num_inliers.size())
 		{
-			best_inliers = inliers;
-			best_origin = rand_ori;
-			best_v1 = v1;
+			const size_t batch = std::min<size_t>(RANSAC_BATCH_SIZE, num_inliers.size() - tested);
+			parallelFor(batch, [&](size_t i)
+						{ test_hypothesis(tested + i); });
+			best_count = std::max(best_count, *std::max_element(num_inliers.begin() + tested, num_inliers.begin() + tested + batch));
+			tested += batch;
+
+			const double ratio = static_cast<double>(best_count) / static_cast<double>(pts.cols());
+			const double good = ratio * ratio;
+			if (good >= 1 || (good > 0 && std::log(1 - confidence) / std::log(1 - good) <= static_cast<double>(tested)))
+				break;
 		}
 	}
+	else
+	{
+		parallelFor(num_inliers.size(), test_hypothesis);
+	}
+
+	// The first hypothesis with the most inliers wins
+	std::pair<std::vector<int>, Eigen::Matrix2Xi> best_inliers;
+	Eigen::Vector2f best_origin({0, 0});
+	Eigen::Vector2f best_v1({1, 0});
+	const auto best = std::max_element(num_inliers.begin(), num_inliers.begin() + tested);
+	if (best != num_inliers.begin() + tested && *best > 0)
+	{
+		const size_t i = best - num_inliers.begin();
+		best_origin = origins[i];
+		best_v1 = v1s[i];
+		best_inliers = getInliers(pts, best_origin, best_v1);
+	}
 
 	return std::pair(std::pair(best_origin, best_v1), best_inliers);
 }
@@ -142,16 +175,7 @@ std::pair<Eigen::Vector2f, Eigen::Vector2f> refineGrid(const Eigen::Matrix2Xf &p
 	size_t num = inliers.first.size();
 
 	const std::function std_dev([](const Eigen::Matrix2Xf &_pts, const std::pair<Eigen::Vector2f, Eigen::Vector2f> &_grid)
-								{
-		Eigen::Matrix2Xf delta = _pts;
-		const auto& origin = _grid.first;
-		const auto& v1 = _grid.second;
-		const auto v2 = hexM * _grid.second;
-		for(int i = 0; i < _pts.cols(); i++)
-		{
-			delta.col(i) -= getPoint(roundPtToCoord(_pts.col(i),origin, v1, v2).cast<float>(), origin, v1, v2);
-		}
-		return delta.colwise().squaredNorm().rowwise().sum().col(0)(0); });
+								{ return getLatticeCoords(_pts, _grid.first, _grid.second, hexM * _grid.second).residuals.sum(); });
 
 	float s = std_dev(pts, new_grid);
 	while (static_cast<long long>(num) < pts.cols())
@@ -180,9 +204,10 @@ std::pair<Eigen::Vector2f, Eigen::Vector2f> refineGrid(const Eigen::Matrix2Xf &p
 	return new_grid;
 }
 
-pair<pair<Eigen::Vector2f, Eigen::Vector2f>, Eigen::Matrix2Xi> getGridAndCoords(const Eigen::Matrix2Xf &pts, const int &num)
+pair<pair<Eigen::Vector2f, Eigen::Vector2f>, Eigen::Matrix2Xi> getGridAndCoords(const Eigen::Matrix2Xf &pts, const spatialGrid &index,
+																				 const int &num, const unsigned &seed, const float &confidence)
 {
-	const pair<pair<Eigen::Vector2f, Eigen::Vector2f>, pair<vector<int>, Eigen::Matrix2Xi>> grid = initGridInliers(pts, num);
+	const pair<pair<Eigen::Vector2f, Eigen::Vector2f>, pair<vector<int>, Eigen::Matrix2Xi>> grid = initGridInliers(pts, index, num, seed, confidence);
 	const pair<Eigen::Vector2f, Eigen::Vector2f> refinedGrid = refineGrid(pts, grid.first, grid.second);
 	const Eigen::Vector2f origin = refinedGrid.first;
 	const Eigen::Vector2f v1 = refinedGrid.second;
@@ -192,103 +217,230 @@ pair<pair<Eigen::Vector2f, Eigen::Vector2f>, Eigen::Matrix2Xi> getGridAndCoords(
 	return {refinedGrid, int_coords};
 }
 
-pair<int, int> getPair(const Eigen::Vector2i &coord)
+// Occupied lattice cells. A bitmap over the bounding box of the cells that can be reached, with a hash set
+// instead when the box is far larger than the number of cells, e.g. for a degenerate grid fit.
+class latticeOccupancy
 {
-	return std::pair(coord(0), coord(1));
-}
+public:
+	latticeOccupancy(const Eigen::Vector2i &lo, const Eigen::Vector2i &hi, size_t expected)
+		: lo(lo), width(static_cast<int64_t>(hi(0)) - lo(0) + 1), height(static_cast<int64_t>(hi(1)) - lo(1) + 1)
+	{
+		if (width > 0 && height > 0 && width * height <= std::max<int64_t>(int64_t(1) << 20, 64 * static_cast<int64_t>(expected)))
+		{
+			bitmap.assign(width * height, false);
+		}
+		else
+		{
+			cells.reserve(expected);
+		}
+	}
+
+	// Marks the cell, returns false if it was already occupied
+	bool insert(const Eigen::Vector2i &coord)
+	{
+		const int64_t x = static_cast<int64_t>(coord(0)) - lo(0);
+		const int64_t y = static_cast<int64_t>(coord(1)) - lo(1);
+		if (!bitmap.empty() && x >= 0 && y >= 0 && x < width && y < height)
+		{
+			const bool occupied = bitmap[y * width + x];
+			bitmap[y * width + x] = true;
+			return !occupied;
+		}
+		return cells.insert(static_cast<int64_t>(coord(0)) << 32 | static_cast<uint32_t>(coord(1))).second;
+	}
+
+private:
+	Eigen::Vector2i lo;
+	int64_t width;
+	int64_t height;
+	vector<bool> bitmap;
+	std::unordered_set<int64_t> cells;
+};
 
 #define GROW_AND_COVER_NEIGHBORS \
 	{1, 0}, {0, 1}, {-1, 1}, {-1, 0}, {0, -1}, { 1, -1 }
-Eigen::Matrix2Xf growAndCover(const Eigen::Matrix2Xf &pts, const Eigen::Matrix2Xf &samples, const unsigned &wid, const unsigned &num)
+Eigen::Matrix2Xf growAndCover(const Eigen::Matrix2Xf &pts, const Eigen::Matrix2Xf &samples, const unsigned &wid, const unsigned &num,
+							  const unsigned &seed, const float &confidence, pair<Eigen::Vector2f, Eigen::Vector2f> *grid_out)
+{
+	// Fit the grid to pts, the index is shared by all queries on this slice
+	const spatialGrid index(pts);
+	const auto grid = getGridAndCoords(pts, index, static_cast<int>(num), seed, confidence).first;
+	if (grid_out)
+	{
+		*grid_out = grid;
+	}
+	return growAndCover(pts, samples, wid, grid);
+}
+
+Eigen::Matrix2Xf growAndCover(const Eigen::Matrix2Xf &pts, const Eigen::Matrix2Xf &samples, const unsigned &wid,
+							  const pair<Eigen::Vector2f, Eigen::Vector2f> &grid)
 {
 	Eigen::Matrix<int, 2, 6> neighbors = Eigen::Matrix<int, 6, 2>({GROW_AND_COVER_NEIGHBORS}).transpose();
 	Eigen::Matrix<int, 2, 7> neighbors_and_self = Eigen::Matrix<int, 7, 2>({GROW_AND_COVER_NEIGHBORS, {0, 0}}).transpose();
 
 	// Get the coordinates from pts
-	const auto [grid, coords] = getGridAndCoords(pts, static_cast<int>(num));
-	Eigen::Matrix2Xi new_coords(2, 0);
 	Eigen::Vector2f origin = grid.first;
 	Eigen::Vector2f v1 = grid.second;
 	Eigen::Vector2f v2 = hexM * v1;
+	const Eigen::Matrix2Xi coords = roundPtsToCoords(pts, origin, v1, v2);
+
+	const Eigen::Matrix2Xi sample_coords = roundPtsToCoords(samples, origin, v1, v2);
 
-	// FIXME: this isn't really a hashmap though
-	// Save existing points on the grid to the map
-	map<pair<int, int>, bool> hash;
+	// Every cell that can be reached lies within wid + 1 cells of a point or sample
+	Eigen::Vector2i lo = Eigen::Vector2i::Zero();
+	Eigen::Vector2i hi = Eigen::Vector2i::Zero();
+	if (coords.cols() > 0)
+	{
+		lo = coords.rowwise().minCoeff();
+		hi = coords.rowwise().maxCoeff();
+	}
+	if (sample_coords.cols() > 0)
+	{
+		lo = lo.cwiseMin(sample_coords.rowwise().minCoeff());
+		hi = hi.cwiseMax(sample_coords.rowwise().maxCoeff());
+	}
+	const int margin = static_cast<int>(std::min<unsigned>(wid, 1 << 20)) + 1;
+	latticeOccupancy occupied((lo.array() - margin).matrix(), (hi.array() + margin).matrix(), coords.cols() + 7 * samples.cols());
+
+	// Save existing points on the grid
 	for (int i = 0; i < coords.cols(); ++i)
 	{
-		Eigen::Vector2i coord = coords.col(i);
-		hash[getPair(coord)] = true;
+		occupied.insert(coords.col(i));
 	}
 
-	// if its nearest grid point and or any of its 6 - neighbors are not in the hash, add them to the hash and the new coordinates
+	// if its nearest grid point and or any of its 6 - neighbors are not occupied, add them to the new coordinates
+	vector<Eigen::Vector2i> new_coords;
+	new_coords.reserve(samples.cols());
 	for (int i = 0; i < samples.cols(); i++)
 	{
-		Eigen::Vector2i sample_cast = roundPtToCoord(samples.col(i), origin, v1, v2);
+		Eigen::Vector2i sample_cast = sample_coords.col(i);
 
 		// Check the surrounding points (and itself)
 		for (Eigen::Vector2i neighbor_delta : neighbors_and_self.colwise())
 		{
 			Eigen::Vector2i neighbor = sample_cast + neighbor_delta;
-			pair<int, int> neighbor_pair = getPair(neighbor);
 
-			// If the neighbor is not found
-			if (!hash.contains(neighbor_pair))
+			// If the neighbor is not occupied yet
+			if (occupied.insert(neighbor))
 			{
-				// Store it in the hash
-				hash[neighbor_pair] = true;
-
-				// Append neighbor to newCoords
-				new_coords.conservativeResize(Eigen::NoChange, new_coords.cols() + 1);
-				new_coords.col(new_coords.cols() - 1) = neighbor;
+				new_coords.push_back(neighbor);
 			}
 		}
 	}
 
-	// Queue of the base points that exist
+	// Frontier of the breadth first growth, starting from the base points that exist
 	vector<Eigen::Vector2i> coordinate_queue;
-	coordinate_queue.reserve(coords.cols() + new_coords.cols());
+	coordinate_queue.reserve(coords.cols() + new_coords.size());
 	for (int i = 0; i < coords.cols(); i++)
 	{
 		coordinate_queue.emplace_back(coords.col(i));
 	}
+	coordinate_queue.insert(coordinate_queue.end(), new_coords.begin(), new_coords.end());
 
-	for (int i = 0; i < new_coords.cols(); i++)
+	vector<Eigen::Vector2i> new_queue;
+	for (unsigned int i = 0; i < wid && !coordinate_queue.empty(); i++)
 	{
-		coordinate_queue.emplace_back(new_coords.col(i));
-	}
-
-	for (unsigned int i = 0; i < wid; i++)
-	{
-		vector<Eigen::Vector2i> new_queue;
+		new_queue.clear();
 		for (const Eigen::Vector2i &loc : coordinate_queue)
 		{
-			// Check the surrounding points (and itself)
+			// Check the surrounding points
 			for (int j = 0; j < neighbors.cols(); j++)
 			{
 				Eigen::Vector2i neighbor = loc + neighbors.col(j);
-				pair<int, int> neighbor_pair = getPair(neighbor);
-				// If the neighbor is not found
-				if (!hash.contains(neighbor_pair))
+				// If the neighbor is not occupied yet
+				if (occupied.insert(neighbor))
 				{
-					// Store it in the hash
-					hash[neighbor_pair] = true;
-
-					// Append neighbor to new_coords
-					new_coords.conservativeResize(Eigen::NoChange, new_coords.cols() + 1);
-					new_coords.col(new_coords.cols() - 1) = neighbor;
-
-					// Append neighbor to the next queue
-					new_queue.emplace_back(neighbor);
+					new_coords.push_back(neighbor);
+					new_queue.push_back(neighbor);
 				}
 			}
 		}
-		coordinate_queue = new_queue;
+		std::swap(coordinate_queue, new_queue);
 	}
 
-	Eigen::Matrix2Xf final_result(2, new_coords.cols());
-	for (int i = 0; i < new_coords.cols(); i++)
+	Eigen::Matrix2f basis;
+	basis << v1, v2;
+	Eigen::Matrix2Xf final_result(2, new_coords.size());
+	for (size_t i = 0; i < new_coords.size(); i++)
 	{
-		final_result.col(i) = getPoint(new_coords.col(i).cast<float>(), origin, v1, v2);
+		final_result.col(i) = new_coords[i].cast<float>();
+	}
+	return (basis * final_result).colwise() + origin;
+}
+
+bool triangulateLattice(const Eigen::Matrix2Xf &pts, const pair<Eigen::Vector2f, Eigen::Vector2f> &grid, vector<vector<int>> &tris)
+{
+	const auto &[origin, v1] = grid;
+	if (pts.cols() == 0 || !(v1.squaredNorm() > 0))
+		return false;
+	const latticeCoords lattice = getLatticeCoords(pts, origin, v1, hexM * v1);
+	const float errorMargin = HEX_ROUNDING_ERROR * v1.norm();
+	if (!(lattice.residuals.array() < errorMargin * errorMargin).all())
+		return false;
+
+	// Point at every lattice point of the bounding box, a box far larger than the slice means a bad fit
+	const Eigen::Vector2i lo = lattice.coords.rowwise().minCoeff();
+	const Eigen::Vector2i hi = lattice.coords.rowwise().maxCoeff();
+	const int64_t width = static_cast<int64_t>(hi(0)) - lo(0) + 1;
+	const int64_t height = static_cast<int64_t>(hi(1)) - lo(1) + 1;
+	if (width * height > std::max<int64_t>(int64_t(1) << 20, 64 * static_cast<int64_t>(pts.cols())))
+		return false;
+	vector<int> point_at(width * height, -1);
+	for (int i = 0; i < pts.cols(); i++)
+	{
+		int &cell = point_at[(lattice.coords(1, i) - lo(1)) * width + (lattice.coords(0, i) - lo(0))];
+		if (cell != -1)
+			return false;
+		cell = i;
+	}
+	auto get_point = [&](int64_t x, int64_t y)
+	{
+		return x < width && y < height ? point_at[y * width + x] : -1;
+	};
+
+	// The cell spanned by v1 and v2 at (x, y) splits into (x, y), (x + 1, y), (x, y + 1) and
+	// (x + 1, y), (x + 1, y + 1), (x, y + 1), both counterclockwise as v2 is v1 turned by pi / 3
+	tris.clear();
+	tris.reserve(2 * pts.cols());
+	for (int64_t y = 0; y < height; y++)
+	{
+		for (int64_t x = 0; x < width; x++)
+		{
+			const int right = get_point(x + 1, y);
+			const int up = get_point(x, y + 1);
+			if (right == -1 || up == -1)
+				continue;
+			const int self = point_at[y * width + x];
+			if (self != -1)
+				tris.push_back({self, right, up});
+			const int diagonal = get_point(x + 1, y + 1);
+			if (diagonal != -1)
+				tris.push_back({right, diagonal, up});
+		}
+	}
+	return !tris.empty();
+}
+
+vector<int> getLatticeSubsample(const Eigen::Matrix2Xf &pts, const pair<Eigen::Vector2f, Eigen::Vector2f> &grid, int stride)
+{
+	vector<int> indices;
+	indices.reserve(stride > 1 ? pts.cols() / (stride * stride) + 1 : pts.cols());
+	if (stride <= 1 || !(grid.second.squaredNorm() > 0))
+	{
+		for (int i = 0; i < pts.cols(); i++)
+		{
+			indices.push_back(i);
+		}
+		return indices;
+	}
+
+	const Eigen::Matrix2Xi coords = roundPtsToCoords(pts, grid.first, grid.second, hexM * grid.second);
+	for (int i = 0; i < pts.cols(); i++)
+	{
+		if (coords(0, i) % stride == 0 && coords(1, i) % stride == 0)
+		{
+			indices.push_back(i);
+		}
 	}
-	return final_result;
+	return indices;
 }
@@ -1,11 +1,29 @@
 #pragma once
 
+#include "SpatialIndex.h"
 #include "UtilityFunctions.h"
 
 #define HEX_ROUNDING_ERROR 0.2f
+// hypotheses tested between two checks of the confidence target
+#define RANSAC_BATCH_SIZE 16
 
 Eigen::Matrix2Xf growAndCover(const Eigen::Matrix2Xf& pts, const Eigen::Matrix2Xf& samples, const unsigned& wid,
-                              const unsigned& num);
+                              const unsigned& num, const unsigned& seed, const float& confidence = 0,
+                              std::pair<Eigen::Vector2f, Eigen::Vector2f>* grid = nullptr);
+
+//growAndCover on an already fitted {origin, v1} grid, e.g. one from the lattice cache
+Eigen::Matrix2Xf growAndCover(const Eigen::Matrix2Xf& pts, const Eigen::Matrix2Xf& samples, const unsigned& wid,
+                              const std::pair<Eigen::Vector2f, Eigen::Vector2f>& grid);
+
+// Nearest lattice point of every point in one pass, with the squared distance to it as residual
+struct latticeCoords
+{
+	Eigen::Matrix2Xi coords;
+	Eigen::VectorXf residuals;
+};
+
+latticeCoords getLatticeCoords(const Eigen::Matrix2Xf& pts, const Eigen::Vector2f& origin, const Eigen::Vector2f& v1,
+                               const Eigen::Vector2f& v2);
 
 std::pair<std::vector<int>, Eigen::Matrix2Xi> getInliers(const Eigen::Matrix2Xf& pts, const Eigen::Vector2f& origin,
                                                          const Eigen::Vector2f& v1);
@@ -16,8 +34,11 @@ Eigen::Matrix2Xi roundPtsToCoords(const Eigen::Matrix2Xf& pts, const Eigen::Vect
 //	{best origin, best v1},
 //	{inlier indices, inlier matrix}
 //} where the inlier is built off getInliers
+//the num hypotheses are reproducible from the seed, index is a spatialGrid over pts
+//a confidence in (0, 1) stops early once an all inlier hypothesis was drawn with that probability, num is the cap
 std::pair<std::pair<Eigen::Vector2f, Eigen::Vector2f>, std::pair<std::vector<int>, Eigen::Matrix2Xi>> initGridInliers(
-	const Eigen::Matrix2Xf& pts, const int& num);
+	const Eigen::Matrix2Xf& pts, const spatialGrid& index, const int& num, const unsigned& seed,
+	const float& confidence = 0);
 
 //Gets the best origin and v1 based on the points and the grid passed in to minimize variance
 std::pair<Eigen::Vector2f, Eigen::Vector2f> getGrid(const Eigen::Matrix2Xf& pts, const std::vector<int>& indices,
@@ -29,4 +50,15 @@ std::pair<Eigen::Vector2f, Eigen::Vector2f> refineGrid(const Eigen::Matrix2Xf& p
                                                        const std::pair<std::vector<int>, Eigen::Matrix2Xi>& inliers);
 
 std::pair<std::pair<Eigen::Vector2f, Eigen::Vector2f>, Eigen::Matrix2Xi>
-getGridAndCoords(const Eigen::Matrix2Xf& pts, const int& num);
+getGridAndCoords(const Eigen::Matrix2Xf& pts, const spatialGrid& index, const int& num, const unsigned& seed,
+                 const float& confidence = 0);
+
+//Triangulates points on the hex lattice {origin, v1} directly, two triangles per lattice cell whose corners all exist.
+//Returns false if a point is further than HEX_ROUNDING_ERROR from the lattice or shares its lattice point with another one.
+bool triangulateLattice(const Eigen::Matrix2Xf& pts, const std::pair<Eigen::Vector2f, Eigen::Vector2f>& grid,
+                        std::vector<std::vector<int>>& tris);
+
+//Indices of the points on every stride-th lattice row in both directions of the hex grid {origin, v1}, which form
+//the grid {origin, stride * v1}. All points if stride is 1 or less.
+std::vector<int> getLatticeSubsample(const Eigen::Matrix2Xf& pts, const std::pair<Eigen::Vector2f, Eigen::Vector2f>& grid,
+                                     int stride);
@@ -1,14 +1,18 @@
 
 #include "ImportFunctions.h"
+#include "Alignment.h"
 #include "GrowAndCover.h"
+#include "LatticeCache.h"
 #include "UtilityFunctions.h"
 #include "Timing.h"
 
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 using std::pair;
@@ -208,33 +212,58 @@ tsv_return_type loadTsv(const string &file_name,
 
     // This is the point where parallel vectors are created
 
-    // apply the transformation on all points except those from the first slice
     pair<unsigned int, unsigned int> xy_indices(row_col_indices.second, row_col_indices.first);
     vector<Eigen::Matrix2Xf> slices = mapVector(sliced_records, std::function(
-                                                                    [&xy_indices, &source_targets](const vector<vector<string>> &record, size_t i)
+                                                                    [&xy_indices](const vector<vector<string>> &record, size_t)
                                                                     {
-                                                                        const vector<coord> raw_slice_coordinates_vector = mapVector(
-                                                                            record, std::function(
-                                                                                        [&xy_indices](const vector<string> &row, size_t)
-                                                                                        {
-                                                                                            return pair(
-                                                                                                std::stof(row[xy_indices.first]),
-                                                                                                std::stof(row[xy_indices.second]));
-                                                                                        }));
-                                                                        // If it's the first slice, no adjustment necessary
-                                                                        if (i == 0)
+                                                                        Eigen::Matrix2Xf slice(2, static_cast<Eigen::Index>(record.size()));
+                                                                        for (size_t j = 0; j < record.size(); j++)
                                                                         {
-                                                                            return vectorToMatrix(raw_slice_coordinates_vector);
+                                                                            slice.col(static_cast<Eigen::Index>(j)) << std::stof(record[j][xy_indices.first]),
+                                                                                std::stof(record[j][xy_indices.second]);
                                                                         }
-
-                                                                        // Base the remaining slices coordinate adjustment off of the previous one
-                                                                        // Basically the other slices get transformed so that they match the coordinates of the first
-                                                                        // All the transforms are independent.
-                                                                        const std::function transform = getTransSVD(
-                                                                            source_targets[i - 1].first, source_targets[i - 1].second);
-                                                                        return vectorToMatrix(transform(raw_slice_coordinates_vector));
+                                                                        return slice;
                                                                     }));
 
+    // apply the transformation on all points except those from the first slice
+    // Basically the other slices get transformed so that they match the coordinates of the first
+    vector<Eigen::Affine2f> transforms(slices.size(), Eigen::Affine2f::Identity());
+    if (alignment_mode == "file")
+    {
+        // All the transforms are independent.
+        for (size_t i = 1; i < slices.size(); i++)
+        {
+            transforms[i] = getTransSVD(source_targets[i - 1].first, source_targets[i - 1].second);
+        }
+    }
+    else
+    {
+        if (alignment_mode != "rigid" && alignment_mode != "similarity")
+        {
+            throw std::runtime_error("Unsupported alignment: " + alignment_mode);
+        }
+        log("Aligning Slices.");
+        vector<vector<int>> spot_clusters;
+        if (alignment_clusters)
+        {
+            spot_clusters = mapVector(sliced_records, std::function([&](const vector<vector<string>> &record, size_t)
+                                                                    { return mapVector(record, std::function([&](const vector<string> &row, size_t)
+                                                                                                             { return std::stoi(row[cluster_ind]); })); }));
+        }
+        transforms = alignSlices(slices, alignment_mode == "similarity", alignment_clusters ? &spot_clusters : nullptr);
+    }
+    // in place, column by column, so only a fixed size 2D vector is ever held on the side
+    for (size_t i = 1; i < slices.size(); i++)
+    {
+        const Eigen::Matrix2f linear = transforms[i].linear();
+        const Eigen::Vector2f translation = transforms[i].translation();
+        for (Eigen::Index j = 0; j < slices[i].cols(); j++)
+        {
+            const Eigen::Vector2f point = slices[i].col(j);
+            slices[i].col(j).noalias() = linear * point + translation;
+        }
+    }
+
     // Convert the clusters into an array of 1/0 based on the cluster index (one hot indexing)
     // Clusters are represented as vectors with all values zero, except a single 1 in the ith place where i is the cluster it belongs to
     vector<vector<vector<float>>> original_clusters = mapVector(sliced_records, std::function(
@@ -275,42 +304,57 @@ tsv_return_type loadTsv(const string &file_name,
 
     std::chrono::steady_clock::time_point start_cover_and_grow = std::chrono::high_resolution_clock::now();
     log("Growing Slices.");
-    // Add buffer to each slice and grow and cover neighboring slices
+    // Grids fitted by an earlier run to the same points with the same settings are reused
+    const vector<latticeCacheEntry> lattice_cache = lattice_cache_path.empty() ? vector<latticeCacheEntry>() : readLatticeCache(lattice_cache_path);
+    vector<latticeCacheEntry> lattice_entries(slices.size());
+    // Add buffer to each slice and grow and cover neighboring slices, keeping the hex grid each one was grown on
+    vector<pair<Eigen::Vector2f, Eigen::Vector2f>> lattices(slices.size());
     vector<Eigen::Matrix2Xf> new_slice_data = mapVector(slices, std::function([&](const Eigen::Matrix2Xf &, size_t i)
                                                                               {
-        log("  ", i + 1, "/", slices.size(), " slices");
-        // If it's the first slice
+        // If it's the first slice or the last slice, grow over the only neighboring slice
+        Eigen::Matrix2Xf samples;
         if(i == 0)
         {
-            return growAndCover(slices[i], slices[i + 1], wid_buffer, num_ransac);
+            samples = slices[i + 1];
         }
-
-        // If it's the last slice
         else if(i == slices.size() - 1)
         {
-            return growAndCover(slices[i], slices[i - 1], wid_buffer, num_ransac);
+            samples = slices[i - 1];
         }
-
         // All other slices, first combine points from the previous and next slices together
-        Eigen::Matrix2Xf top_and_bottom_slice(2, slices[i + 1].cols() + slices[i - 1].cols());
-        top_and_bottom_slice << slices[i + 1], slices[i - 1];
-        return growAndCover(slices[i], top_and_bottom_slice, wid_buffer, num_ransac); }));
+        else
+        {
+            samples.resize(2, slices[i + 1].cols() + slices[i - 1].cols());
+            samples << slices[i + 1], slices[i - 1];
+        }
+
+        lattice_entries[i].key = getLatticeKey(slices[i], num_ransac, ransac_seed, ransac_confidence);
+        const auto *cached = findLattice(lattice_cache, lattice_entries[i].key);
+        if(cached)
+        {
+            log("  ", i + 1, "/", slices.size(), " slices, cached grid");
+            lattices[i] = *cached;
+            lattice_entries[i].grid = *cached;
+            return growAndCover(slices[i], samples, wid_buffer, *cached);
+        }
+
+        log("  ", i + 1, "/", slices.size(), " slices");
+        Eigen::Matrix2Xf grown = growAndCover(slices[i], samples, wid_buffer, num_ransac, ransac_seed, ransac_confidence, &lattices[i]);
+        lattice_entries[i].grid = lattices[i];
+        return grown; }));
+    if (!lattice_cache_path.empty())
+    {
+        writeLatticeCache(lattice_cache_path, lattice_entries);
+    }
 
     vector<Eigen::Matrix3Xf> slices3d = mapThread(
         new_slice_data, slices, std::function([z_distance](const Eigen::Matrix2Xf &new_slice, const Eigen::Matrix2Xf &old_slice, size_t i)
                                               {
-                Eigen::Matrix2Xf layer2d(
-                    2, new_slice.cols() + old_slice.cols());
-                layer2d << old_slice, new_slice;
-                //The old and new points on that layer (in that order)
-                Eigen::Matrix3Xf layer3d(3, layer2d.cols());
-                for(int j = 0; j < layer2d.cols(); j++)
-                {
-                    layer3d.col(j)(0) = layer2d.col(j)(0);
-                    layer3d.col(j)(1) = layer2d.col(j)(1);
-                    layer3d.col(j)(2) = static_cast<float>(z_distance * i);
-                }
-
+                //The old and new points on that layer (in that order), lifted to the height of the layer
+                Eigen::Matrix3Xf layer3d(3, old_slice.cols() + new_slice.cols());
+                layer3d.topLeftCorner(2, old_slice.cols()) = old_slice;
+                layer3d.topRightCorner(2, new_slice.cols()) = new_slice;
+                layer3d.row(2).setConstant(static_cast<float>(z_distance * i));
                 return layer3d; }));
 
     // Associating data with the new points on their respective slices
@@ -332,44 +376,45 @@ tsv_return_type loadTsv(const string &file_name,
 
     log("Adding bounding slices.");
 
-    // Add empty top and bottom slices
+    // Add empty top and bottom slices. With a cap stride above 1 (the default is 2) they only hold the points on every
+    // cap_stride-th lattice row of the slice next to them, which closes the surfaces as well. Slices without a fitted
+    // lattice get a full copy.
+    auto get_cap = [&](size_t i, float dz)
     {
-        auto &topSlice = slices3d[slices3d.size() - 1];
-        Eigen::Matrix3Xf top(3, topSlice.cols());
-        for (int i = 0; i < topSlice.cols(); i++)
+        const vector<int> indices = getLatticeSubsample(slices3d[i].topRows(2), lattices[i], cap_stride);
+        Eigen::Matrix3Xf cap(3, static_cast<Eigen::Index>(indices.size()));
+        for (size_t j = 0; j < indices.size(); j++)
         {
-            top.col(i) = topSlice.col(i) + Eigen::Vector3f({0, 0, static_cast<float>(z_distance)});
+            cap.col(static_cast<Eigen::Index>(j)) = slices3d[i].col(indices[j]) + Eigen::Vector3f({0, 0, dz});
         }
-        slices3d.push_back(top);
-
-        auto &bottomSlice = slices3d[0];
-        Eigen::Matrix3Xf bottom(3, bottomSlice.cols());
-        for (int i = 0; i < bottomSlice.cols(); i++)
-        {
-            bottom.col(i) = bottomSlice.col(i) - Eigen::Vector3f({0, 0, static_cast<float>(z_distance)});
-        }
-        slices3d.insert(slices3d.begin(), bottom);
-        // TODO: Inefficient O(n) call. Consider changing in all three locations.
-    }
+        return cap;
+    };
+    Eigen::Matrix3Xf bottom = get_cap(0, -static_cast<float>(z_distance));
+    Eigen::Matrix3Xf top = get_cap(slices3d.size() - 1, static_cast<float>(z_distance));
+    // the grid a cap lies on, every cap_stride-th point of the grid of its slice
+    auto get_cap_lattice = [](const pair<Eigen::Vector2f, Eigen::Vector2f> &grid)
     {
-        auto &topSlice = grown_clusters[grown_clusters.size() - 1];
-        vector top(topSlice.size(), getClusterArray(newClusters + 1, newClusters));
-        grown_clusters.push_back(top);
-
-        auto &bottomSlice = grown_clusters[0];
-        vector bottom(bottomSlice.size(), getClusterArray(newClusters + 1, newClusters));
-        grown_clusters.insert(grown_clusters.begin(), bottom);
-    }
+        return pair<Eigen::Vector2f, Eigen::Vector2f>(grid.first, grid.second * static_cast<float>(std::max(cap_stride, 1)));
+    };
 
+    // the slices go between the caps in one pass instead of inserting at the front
+    auto add_caps = [](auto &layers, auto bottom_cap, auto top_cap)
     {
-        auto &topSlice = grown_values[grown_values.size() - 1];
-        vector top(topSlice.size(), getClusterArray(newFeatures + 1, newFeatures));
-        grown_values.push_back(top);
-
-        auto &bottomSlice = grown_values[0];
-        vector bottom(bottomSlice.size(), getClusterArray(newFeatures + 1, newFeatures));
-        grown_values.insert(grown_values.begin(), bottom);
-    }
+        std::remove_reference_t<decltype(layers)> capped;
+        capped.reserve(layers.size() + 2);
+        capped.push_back(std::move(bottom_cap));
+        std::move(layers.begin(), layers.end(), std::back_inserter(capped));
+        capped.push_back(std::move(top_cap));
+        layers = std::move(capped);
+    };
+    const auto bottom_size = static_cast<size_t>(bottom.cols());
+    const auto top_size = static_cast<size_t>(top.cols());
+    add_caps(grown_clusters, vector(bottom_size, getClusterArray(newClusters + 1, newClusters)),
+             vector(top_size, getClusterArray(newClusters + 1, newClusters)));
+    add_caps(grown_values, vector(bottom_size, getClusterArray(newFeatures + 1, newFeatures)),
+             vector(top_size, getClusterArray(newFeatures + 1, newFeatures)));
+    add_caps(lattices, get_cap_lattice(lattices.front()), get_cap_lattice(lattices.back()));
+    add_caps(slices3d, std::move(bottom), std::move(top));
 
     std::chrono::steady_clock::time_point end_cover_and_grow = std::chrono::high_resolution_clock::now();
     cover_and_grow = duration_cast<std::chrono::microseconds>(end_cover_and_grow - start_cover_and_grow).count();
@@ -381,6 +426,9 @@ tsv_return_type loadTsv(const string &file_name,
     ret.slices = slices3d;
     ret.values = grown_values;
     ret.clusters = grown_clusters;
+    ret.lattices = lattices;
+    ret.valueArgmax = mapVector(ret.values, std::function(getMaterialArgmax));
+    ret.clusterArgmax = mapVector(ret.clusters, std::function(getMaterialArgmax));
     log("TSV Import Complete.");
     return ret;
 }
@@ -412,13 +460,15 @@ Eigen::Matrix2f getSVDRotation(colCoordMat source_matrix, colCoordMat target_mat
     //(* SVD decomposition *)
     const Eigen::JacobiSVD<colCoordMat> svd(mat, Eigen::ComputeThinU | Eigen::ComputeThinV);
     //(* obtaining the rotation *)
-    Eigen::Matrix2f r = (svd.matrixU() * svd.matrixV().transpose()).transpose(); // This is definitely a rotation matrix
+    // flip the last axis if U and V differ by a reflection, so the result is always a proper rotation
+    Eigen::Matrix2f d = Eigen::Matrix2f::Identity();
+    d(1, 1) = (svd.matrixV() * svd.matrixU().transpose()).determinant() < 0 ? -1.0f : 1.0f;
+    Eigen::Matrix2f r = svd.matrixV() * d * svd.matrixU().transpose(); // This is definitely a rotation matrix
 
     return r;
 }
 
-std::function<vector<coord>(vector<coord>)> getTransSVD(const vector<coord> &source,
-                                                        const vector<coord> &target)
+Eigen::Affine2f getTransSVD(const vector<coord> &source, const vector<coord> &target)
 {
     const auto sourceMatrix = vectorToMatrix(source);
     const auto targetMatrix = vectorToMatrix(target);
@@ -434,15 +484,8 @@ std::function<vector<coord>(vector<coord>)> getTransSVD(const vector<coord> &sou
     const Eigen::Translation2f netTranslation(targetCentroidTransform);
     const Eigen::Translation2f toZero(-1 * sourceCentroid);
     const Eigen::Translation2f fromZero(sourceCentroid);
-    Eigen::Transform<float, 2, Eigen::Affine> finalTransform = netTranslation * fromZero * rotation * toZero;
     // Translate after rotate
-
-    //(* transform *) Creating the function
-    return {
-        [finalTransform](vector<coord> points)
-        {
-            return matrixToVector(finalTransform * vectorToMatrix(std::move(points)));
-        }};
+    return netTranslation * fromZero * rotation * toZero;
 }
 
 vector<float> getClusterArray(size_t length, size_t i)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Contour2D.h"
 #include "GrowAndCover.h"
 #include "UtilityFunctions.h"
 
@@ -20,6 +21,13 @@ using std::function;
 
 extern int wid_buffer;
 extern int num_ransac;
+extern unsigned ransac_seed;
+extern float ransac_confidence;
+// "file" for the landmarks of the alignment file, "rigid" or "similarity" to align the spots by ICP
+extern string alignment_mode;
+extern bool alignment_clusters;
+// lattice stride of the points in the empty top and bottom slices, 1 copies the whole slice
+extern int cap_stride;
 
 struct tsv_return_type
 {
@@ -29,6 +37,11 @@ struct tsv_return_type
 	vector<Eigen::Matrix3Xf> slices;
 	vector<vector<vector<float>>> clusters;
 	vector<vector<vector<float>>> values;
+	// primary material, top and second best value of every point, per slice
+	vector<materialArgmax> clusterArgmax;
+	vector<materialArgmax> valueArgmax;
+	// {origin, v1} of the hex grid every slice was grown on
+	vector<pair<Eigen::Vector2f, Eigen::Vector2f>> lattices;
 };
 
 vector<pair<vector<coord>, vector<coord>>> importAlignments(const string &alignment_file);
@@ -43,11 +56,14 @@ tsv_return_type loadTsv(const string &file_name,
                         unsigned int z_distance,
                         vector<pair<vector<coord>, vector<coord>>> source_targets);
 
-function<vector<coord>(vector<coord>)> getTransSVD(const vector<coord> &source, const vector<coord> &target);
+// Rigid transform taking the source landmarks onto the target landmarks
+Eigen::Affine2f getTransSVD(const vector<coord> &source, const vector<coord> &target);
 
 // this helper function produces an array of length n, which is all zero except a 1 in the i-th spot.
 vector<float> getClusterArray(size_t length, size_t i);
 
 Eigen::Matrix2f getSVDRotation(colCoordMat source_matrix, colCoordMat target_matrix);
 
+Eigen::Vector2f getCentroid(colCoordMat sourceMatrix);
+
 colCoordMat translateToZeroCentroid(colCoordMat source_matrix);
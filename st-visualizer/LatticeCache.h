@@ -0,0 +1,135 @@
+#ifndef ST_VISUALIZER_LATTICECACHE_H
+#define ST_VISUALIZER_LATTICECACHE_H
+
+#include "GrowAndCover.h"
+
+#include <Eigen/Eigen>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::string;
+using std::vector;
+
+extern string lattice_cache_path;
+
+// Bumped whenever the fit itself (hypotheses, inlier test, refinement) changes, so older grids miss the cache
+#define LATTICE_CACHE_VERSION 2
+
+// A fitted {origin, v1} hex grid, keyed by the points of the slice and the settings of the fit
+struct latticeCacheEntry
+{
+    uint64_t key = 0;
+    pair<Eigen::Vector2f, Eigen::Vector2f> grid;
+};
+
+// FNV-1a over everything the fitted grid depends on: the point coordinates, the RANSAC settings (num, seed,
+// confidence) and the compile time constants of the fit (HEX_ROUNDING_ERROR, RANSAC_BATCH_SIZE).
+// Changes to the fitting code are covered by LATTICE_CACHE_VERSION instead.
+inline uint64_t getLatticeKey(const Eigen::Matrix2Xf &pts, int num, unsigned seed, float confidence)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *data, size_t size)
+    {
+        const auto *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    const int64_t count = pts.cols();
+    add(&count, sizeof(count));
+    add(pts.data(), static_cast<size_t>(pts.size()) * sizeof(float));
+    add(&num, sizeof(num));
+    add(&seed, sizeof(seed));
+    add(&confidence, sizeof(confidence));
+    const float rounding_error = HEX_ROUNDING_ERROR;
+    const int batch_size = RANSAC_BATCH_SIZE;
+    add(&rounding_error, sizeof(rounding_error));
+    add(&batch_size, sizeof(batch_size));
+    return hash;
+}
+
+// Entries of the cache at path, empty if there is no cache or it was written by another version
+inline vector<latticeCacheEntry> readLatticeCache(const string &path)
+{
+    const int32_t version = LATTICE_CACHE_VERSION;
+    vector<latticeCacheEntry> entries;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return entries;
+
+    int32_t cached_version = 0;
+    file.read(reinterpret_cast<char *>(&cached_version), sizeof(cached_version));
+    int64_t count = 0;
+    file.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!file || cached_version != version || count < 0)
+        return entries;
+
+    for (int64_t i = 0; i < count; i++)
+    {
+        latticeCacheEntry entry;
+        float values[4];
+        file.read(reinterpret_cast<char *>(&entry.key), sizeof(entry.key));
+        file.read(reinterpret_cast<char *>(values), sizeof(values));
+        if (!file)
+            return {};
+        entry.grid = {{values[0], values[1]}, {values[2], values[3]}};
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+// Writes through a temporary file, a cache that could not be written is left as it was
+inline void writeLatticeCache(const string &path, const vector<latticeCacheEntry> &entries)
+{
+    const int32_t version = LATTICE_CACHE_VERSION;
+    const string temp_path = path + ".tmp";
+    bool written = false;
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            log("  unable to write the lattice cache to ", path);
+            return;
+        }
+        const int64_t count = entries.size();
+        file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+        for (const latticeCacheEntry &entry : entries)
+        {
+            const float values[4] = {entry.grid.first(0), entry.grid.first(1), entry.grid.second(0), entry.grid.second(1)};
+            file.write(reinterpret_cast<const char *>(&entry.key), sizeof(entry.key));
+            file.write(reinterpret_cast<const char *>(values), sizeof(values));
+        }
+        file.close();
+        written = static_cast<bool>(file);
+    }
+
+    std::error_code error;
+    if (written)
+        std::filesystem::rename(temp_path, path, error);
+    if (!written || error)
+    {
+        log("  unable to write the lattice cache to ", path);
+        std::filesystem::remove(temp_path, error);
+    }
+}
+
+// Grid of the entry with the given key, or nullptr
+inline const pair<Eigen::Vector2f, Eigen::Vector2f> *findLattice(const vector<latticeCacheEntry> &entries, uint64_t key)
+{
+    for (const latticeCacheEntry &entry : entries)
+    {
+        if (entry.key == key)
+            return &entry.grid;
+    }
+    return nullptr;
+}
+
+#endif //ST_VISUALIZER_LATTICECACHE_H
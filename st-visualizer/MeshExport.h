@@ -0,0 +1,234 @@
+#ifndef ST_VISUALIZER_MESHEXPORT_H
+#define ST_VISUALIZER_MESHEXPORT_H
+
+#include "JSONParser.h"
+#include "UtilityFunctions.h"
+
+#include <Eigen/Eigen>
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using nlohmann::json;
+using std::pair;
+using std::string;
+using std::vector;
+
+using meshType = pair<vector<Eigen::Vector3f>, vector<vector<int>>>;
+
+template <typename T>
+void appendBytes(vector<char> &out, const T *data, size_t count)
+{
+    const char *bytes = reinterpret_cast<const char *>(data);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+inline void appendText(vector<char> &out, const string &text)
+{
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+inline void writeBytes(const string &path, const vector<char> &bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open file");
+    }
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// every directed edge may only be used by one face of a consistently oriented surface
+inline int checkOrientation(const vector<vector<int>> &faces)
+{
+    Hash_Edge_to_Face hash;
+    int errors = 0;
+    for (int j = 0; j < faces.size(); j++)
+    {
+        const vector<int> &face = faces.at(j);
+        for (int k = 0; k < face.size(); k++)
+        {
+            const pair<int, int> edge = {face.at(k), face.at((k + 1) % face.size())};
+            int &target = edge.first < edge.second ? hash.at(edge.first, edge.second).first : hash.at(edge.first, edge.second).second;
+            if (target != -1)
+            {
+                errors++;
+            }
+            else
+            {
+                target = j;
+            }
+        }
+    }
+    return errors;
+}
+
+// Same layout as the previous stringstream based writer: fixed notation with 16 decimals, 1-based indices
+inline vector<char> encodeObj(const meshType &mesh)
+{
+    const auto &[vertices, faces] = mesh;
+    vector<char> out;
+    out.reserve(vertices.size() * 64 + faces.size() * 24);
+    char number[64];
+    for (const Eigen::Vector3f &vertex : vertices)
+    {
+        appendText(out, "v");
+        for (int a = 0; a < 3; a++)
+        {
+            out.push_back(' ');
+            char *end = std::to_chars(number, number + sizeof(number), static_cast<double>(vertex(a)),
+                                      std::chars_format::fixed, 16).ptr;
+            out.insert(out.end(), number, end);
+        }
+        out.push_back('\n');
+    }
+    for (const vector<int> &face : faces)
+    {
+        appendText(out, "f ");
+        for (const int index : face)
+        {
+            char *end = std::to_chars(number, number + sizeof(number), index + 1).ptr;
+            out.insert(out.end(), number, end);
+            out.push_back(' ');
+        }
+        out.push_back('\n');
+    }
+    return out;
+}
+
+// Binary little-endian PLY, faces are kept as polygons
+inline vector<char> encodePly(const meshType &mesh)
+{
+    static_assert(std::endian::native == std::endian::little, "PLY is written in host byte order");
+    const auto &[vertices, faces] = mesh;
+    vector<char> out;
+    appendText(out, "ply\n"
+                    "format binary_little_endian 1.0\n"
+                    "comment st-visualizer\n"
+                    "element vertex " + std::to_string(vertices.size()) + "\n"
+                    "property float x\n"
+                    "property float y\n"
+                    "property float z\n"
+                    "element face " + std::to_string(faces.size()) + "\n"
+                    "property list uchar int vertex_indices\n"
+                    "end_header\n");
+    out.reserve(out.size() + vertices.size() * 12 + faces.size() * 13);
+    for (const Eigen::Vector3f &vertex : vertices)
+    {
+        appendBytes(out, vertex.data(), 3);
+    }
+    for (const vector<int> &face : faces)
+    {
+        const uint8_t count = static_cast<uint8_t>(face.size());
+        appendBytes(out, &count, 1);
+        appendBytes(out, face.data(), face.size());
+    }
+    return out;
+}
+
+// glTF 2.0 binary container with one triangle mesh, polygons are fan triangulated
+inline vector<char> encodeGlb(const meshType &mesh, const string &name)
+{
+    static_assert(std::endian::native == std::endian::little, "GLB is written in host byte order");
+    const auto &[vertices, faces] = mesh;
+
+    vector<uint32_t> indices;
+    indices.reserve(faces.size() * 3);
+    for (const vector<int> &face : faces)
+    {
+        for (size_t k = 1; k + 1 < face.size(); k++)
+        {
+            indices.push_back(face[0]);
+            indices.push_back(face[k]);
+            indices.push_back(face[k + 1]);
+        }
+    }
+
+    vector<char> bin;
+    json gltf = {{"asset", {{"version", "2.0"}, {"generator", "st-visualizer"}}},
+                 {"scene", 0},
+                 {"scenes", {{{"nodes", json::array()}}}}};
+    // accessors must not be empty, an empty material is exported as an empty scene
+    if (!vertices.empty() && !indices.empty())
+    {
+        Eigen::Vector3f lo = vertices[0];
+        Eigen::Vector3f hi = vertices[0];
+        for (const Eigen::Vector3f &vertex : vertices)
+        {
+            appendBytes(bin, vertex.data(), 3);
+            lo = lo.cwiseMin(vertex);
+            hi = hi.cwiseMax(vertex);
+        }
+        const size_t positions_length = bin.size();
+        appendBytes(bin, indices.data(), indices.size());
+
+        gltf["scenes"][0]["nodes"] = {0};
+        gltf["nodes"] = {{{"mesh", 0}, {"name", name}}};
+        gltf["meshes"] = {{{"name", name},
+                           {"primitives", {{{"attributes", {{"POSITION", 0}}}, {"indices", 1}, {"mode", 4}}}}}};
+        gltf["buffers"] = {{{"byteLength", bin.size()}}};
+        gltf["bufferViews"] = {{{"buffer", 0}, {"byteOffset", 0}, {"byteLength", positions_length}, {"target", 34962}},
+                               {{"buffer", 0}, {"byteOffset", positions_length}, {"byteLength", bin.size() - positions_length}, {"target", 34963}}};
+        gltf["accessors"] = {{{"bufferView", 0}, {"componentType", 5126}, {"count", vertices.size()}, {"type", "VEC3"},
+                              {"min", {lo(0), lo(1), lo(2)}}, {"max", {hi(0), hi(1), hi(2)}}},
+                             {{"bufferView", 1}, {"componentType", 5125}, {"count", indices.size()}, {"type", "SCALAR"}}};
+    }
+
+    // both chunks are padded to 4 bytes, json with spaces and the binary data with zeros
+    string text = gltf.dump();
+    text.resize((text.size() + 3) & ~size_t(3), ' ');
+    bin.resize((bin.size() + 3) & ~size_t(3), 0);
+
+    const uint32_t text_length = static_cast<uint32_t>(text.size());
+    const uint32_t bin_length = static_cast<uint32_t>(bin.size());
+    const uint32_t total_length = 12 + 8 + text_length + (bin.empty() ? 0 : 8 + bin_length);
+    const uint32_t header[3] = {0x46546C67, 2, total_length}; // "glTF"
+    const uint32_t text_header[2] = {text_length, 0x4E4F534A}; // "JSON"
+    const uint32_t bin_header[2] = {bin_length, 0x004E4942};   // "BIN\0"
+
+    vector<char> out;
+    out.reserve(total_length);
+    appendBytes(out, header, 3);
+    appendBytes(out, text_header, 2);
+    appendText(out, text);
+    if (!bin.empty())
+    {
+        appendBytes(out, bin_header, 2);
+        out.insert(out.end(), bin.begin(), bin.end());
+    }
+    return out;
+}
+
+// Writes one <path><name>.<format> file per material in parallel, format is obj, ply or glb
+inline void exportMeshes(const string &path, const vector<meshType> &data, const vector<string> &names,
+                         const string &format, bool check_orientation)
+{
+    if (format != "obj" && format != "ply" && format != "glb")
+    {
+        throw std::runtime_error("Unsupported mesh format: " + format);
+    }
+    std::filesystem::create_directories(path);
+
+    parallelFor(data.size(), [&](size_t i)
+                {
+        if (check_orientation && checkOrientation(data[i].second) > 0)
+        {
+            log("Orientation error detected in ", names.at(i), "!");
+        }
+
+        const string file = path + names.at(i) + "." + format;
+        if (format == "ply")
+            writeBytes(file, encodePly(data[i]));
+        else if (format == "glb")
+            writeBytes(file, encodeGlb(data[i], names.at(i)));
+        else
+            writeBytes(file, encodeObj(data[i])); });
+}
+
+#endif //ST_VISUALIZER_MESHEXPORT_H
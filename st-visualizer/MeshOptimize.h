@@ -0,0 +1,256 @@
+#ifndef ST_VISUALIZER_MESHOPTIMIZE_H
+#define ST_VISUALIZER_MESHOPTIMIZE_H
+
+#include "Contour3D.h"
+#include "UtilityFunctions.h"
+
+#include <Eigen/Eigen>
+
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+// size of the FIFO post-transform cache the triangle order is tuned for
+#define VERTEX_CACHE_SIZE 16
+// meshlet limits of common mesh shader pipelines
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// A contiguous run of triangles of one material and the box around them
+struct meshlet
+{
+    uint32_t triangleOffset = 0;
+    uint32_t triangleCount = 0;
+    Eigen::Vector3f min;
+    Eigen::Vector3f max;
+};
+
+// Vertices transformed when drawing the faces with a FIFO post-transform cache, a triangle costs 3 at worst
+inline size_t getCacheMisses(const vector<vector<int>> &faces, size_t num_verts, int cache_size = VERTEX_CACHE_SIZE)
+{
+    // a vertex is in the cache while fewer than cache_size misses happened since it was loaded
+    vector<int64_t> loaded(num_verts, -cache_size);
+    int64_t misses = 0;
+    for (const auto &face : faces)
+    {
+        for (const int v : face)
+        {
+            if (misses - loaded[v] >= cache_size)
+            {
+                loaded[v] = misses;
+                misses++;
+            }
+        }
+    }
+    return misses;
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): fans out around the current vertex and moves on to the
+// neighbor that is still in the cache and has the fewest remaining triangles. Returns the new face order.
+inline vector<int> getTipsifyOrder(const vector<vector<int>> &faces, size_t num_verts, int cache_size = VERTEX_CACHE_SIZE)
+{
+    // faces around every vertex, in compressed rows
+    vector<int> offsets(num_verts + 1, 0);
+    for (const auto &face : faces)
+    {
+        for (const int v : face)
+            offsets[v + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    vector<int> adjacency(offsets.back());
+    {
+        vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for (int j = 0; j < faces.size(); j++)
+        {
+            for (const int v : faces[j])
+                adjacency[fill[v]++] = j;
+        }
+    }
+
+    vector<int> live(num_verts);
+    for (size_t v = 0; v < num_verts; v++)
+    {
+        live[v] = offsets[v + 1] - offsets[v];
+    }
+    vector<int> cache_time(num_verts, 0);
+    vector<bool> emitted(faces.size(), false);
+    vector<int> dead_end;
+    vector<int> candidates;
+    vector<int> order;
+    order.reserve(faces.size());
+
+    int time = cache_size + 1;
+    size_t cursor = 0;
+    int current = num_verts > 0 ? 0 : -1;
+    while (current >= 0)
+    {
+        candidates.clear();
+        for (int k = offsets[current]; k < offsets[current + 1]; k++)
+        {
+            const int j = adjacency[k];
+            if (emitted[j])
+                continue;
+            emitted[j] = true;
+            order.push_back(j);
+            for (const int v : faces[j])
+            {
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cache_time[v] > cache_size)
+                {
+                    cache_time[v] = time;
+                    time++;
+                }
+            }
+        }
+
+        // best candidate that is still in the cache after its remaining triangles are emitted
+        current = -1;
+        int best_priority = -1;
+        for (const int v : candidates)
+        {
+            if (live[v] <= 0)
+                continue;
+            int priority = 0;
+            if (time - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = time - cache_time[v];
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                current = v;
+            }
+        }
+
+        // otherwise the most recently used vertex that has triangles left, or the next one in input order
+        while (current == -1 && !dead_end.empty())
+        {
+            const int v = dead_end.back();
+            dead_end.pop_back();
+            if (live[v] > 0)
+                current = v;
+        }
+        while (current == -1 && cursor < num_verts)
+        {
+            if (live[cursor] > 0)
+                current = static_cast<int>(cursor);
+            cursor++;
+        }
+    }
+    return order;
+}
+
+// Reorders the faces of a mesh for the vertex cache and then the vertices by first use, so the vertex
+// fetches follow the index buffer. neighbors, if given, are the per face neighbor materials and follow the faces.
+// meshlets, if given, receives the mesh split into runs of consecutive triangles within the meshlet limits.
+inline void optimizeMesh(pair<vector<Eigen::Vector3f>, vector<vector<int>>> &mesh, vector<int> *neighbors = nullptr,
+                         vector<meshlet> *meshlets = nullptr)
+{
+    auto &[vertices, faces] = mesh;
+    const vector<int> order = getTipsifyOrder(faces, vertices.size());
+
+    vector<vector<int>> new_faces;
+    new_faces.reserve(faces.size());
+    for (const int j : order)
+    {
+        new_faces.push_back(std::move(faces[j]));
+    }
+    if (neighbors && !neighbors->empty())
+    {
+        *neighbors = subset(*neighbors, order);
+    }
+
+    // vertices that no face uses keep their relative order at the end
+    vector<int> new_index(vertices.size(), -1);
+    vector<int> old_index;
+    old_index.reserve(vertices.size());
+    for (auto &face : new_faces)
+    {
+        for (int &v : face)
+        {
+            if (new_index[v] == -1)
+            {
+                new_index[v] = static_cast<int>(old_index.size());
+                old_index.push_back(v);
+            }
+            v = new_index[v];
+        }
+    }
+    for (int v = 0; v < vertices.size(); v++)
+    {
+        if (new_index[v] == -1)
+            old_index.push_back(v);
+    }
+    vertices = subset(vertices, old_index);
+    faces = std::move(new_faces);
+
+    if (!meshlets)
+        return;
+    meshlets->clear();
+    // meshlet in which each vertex was last counted
+    vector<int> seen(vertices.size(), -1);
+    int num_verts = 0;
+    for (uint32_t j = 0; j < faces.size(); j++)
+    {
+        int added = 0;
+        for (const int v : faces[j])
+        {
+            if (seen[v] != static_cast<int>(meshlets->size()) - 1)
+                added++;
+        }
+        if (meshlets->empty() || num_verts + added > MESHLET_MAX_VERTICES ||
+            meshlets->back().triangleCount >= MESHLET_MAX_TRIANGLES)
+        {
+            meshlets->push_back({j, 0, vertices[faces[j][0]], vertices[faces[j][0]]});
+            num_verts = 0;
+        }
+        meshlet &current = meshlets->back();
+        for (const int v : faces[j])
+        {
+            if (seen[v] != static_cast<int>(meshlets->size()) - 1)
+            {
+                seen[v] = static_cast<int>(meshlets->size()) - 1;
+                num_verts++;
+            }
+            current.min = current.min.cwiseMin(vertices[v]);
+            current.max = current.max.cwiseMax(vertices[v]);
+        }
+        current.triangleCount++;
+    }
+}
+
+// optimizeMesh for every material in parallel. The render meshes, if given, are rebuilt for the new order.
+inline void optimizeMeshes(vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> &meshes,
+                           vector<renderMesh> *render = nullptr, vector<vector<meshlet>> *meshlets = nullptr)
+{
+    if (meshlets)
+    {
+        meshlets->assign(meshes.size(), {});
+    }
+    vector<size_t> misses_before(meshes.size());
+    vector<size_t> misses_after(meshes.size());
+    parallelFor(meshes.size(), [&](size_t i)
+                {
+        misses_before[i] = getCacheMisses(meshes[i].second, meshes[i].first.size());
+        vector<int> neighbors = render ? std::move((*render)[i].neighbors) : vector<int>();
+        optimizeMesh(meshes[i], &neighbors, meshlets ? &(*meshlets)[i] : nullptr);
+        if (render)
+        {
+            (*render)[i] = getRenderMesh(meshes[i], neighbors);
+        }
+        misses_after[i] = getCacheMisses(meshes[i].second, meshes[i].first.size()); });
+
+    size_t num_faces = 0;
+    for (const auto &mesh : meshes)
+    {
+        num_faces += mesh.second.size();
+    }
+    log("  ", num_faces, " triangles, ",
+        std::accumulate(misses_before.begin(), misses_before.end(), size_t(0)), " -> ",
+        std::accumulate(misses_after.begin(), misses_after.end(), size_t(0)), " vertex cache misses");
+}
+
+#endif //ST_VISUALIZER_MESHOPTIMIZE_H
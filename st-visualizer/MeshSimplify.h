@@ -0,0 +1,395 @@
+#ifndef ST_VISUALIZER_MESHSIMPLIFY_H
+#define ST_VISUALIZER_MESHSIMPLIFY_H
+
+#include "Contour3D.h"
+#include "UtilityFunctions.h"
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+using std::array;
+using std::pair;
+using std::vector;
+
+// weight of the planes that pin open borders and material junctions, relative to the surface planes
+#define DECIMATION_FEATURE_WEIGHT 1000.0
+// a collapse is rejected if it turns a surviving triangle by more than ~80 degrees
+#define DECIMATION_MIN_NORMAL_DOT 0.2
+
+// Garland-Heckbert edge collapse on one material's triangle mesh.
+// Edges on the open border of the surface, or between triangles facing different materials, are features:
+// their endpoints only move along the feature and the corners where features meet stay put, so the junction
+// curves between materials are kept.
+class meshDecimator
+{
+public:
+    meshDecimator(const pair<vector<Eigen::Vector3f>, vector<vector<int>>> &mesh, const vector<int> &neighbors)
+        : neighbors(neighbors)
+    {
+        const auto &[vertices, in_faces] = mesh;
+        positions.reserve(vertices.size());
+        for (const Eigen::Vector3f &v : vertices)
+        {
+            positions.emplace_back(v.cast<double>());
+        }
+        quadrics.assign(vertices.size(), Eigen::Matrix4d::Zero());
+        vertex_faces.resize(vertices.size());
+        alive_vertex.assign(vertices.size(), true);
+        stamp.assign(vertices.size(), 0);
+
+        faces.reserve(in_faces.size());
+        for (size_t f = 0; f < in_faces.size(); f++)
+        {
+            faces.push_back({in_faces[f][0], in_faces[f][1], in_faces[f][2]});
+            for (const int v : faces.back())
+            {
+                vertex_faces[v].push_back(static_cast<int>(f));
+            }
+        }
+        alive_face.assign(faces.size(), true);
+        num_faces = faces.size();
+
+        // area weighted face planes
+        for (size_t f = 0; f < faces.size(); f++)
+        {
+            const Eigen::Vector3d n = getNormal(faces[f][0], faces[f][1], faces[f][2]);
+            const double area = 0.5 * n.norm();
+            if (area <= 0)
+                continue;
+            const Eigen::Vector3d unit = n.normalized();
+            const Eigen::Vector4d plane(unit(0), unit(1), unit(2), -unit.dot(positions[faces[f][0]]));
+            const Eigen::Matrix4d q = area * plane * plane.transpose();
+            for (const int v : faces[f])
+            {
+                quadrics[v] += q;
+            }
+        }
+
+        // planes through each feature edge, perpendicular to its triangles
+        for (size_t f = 0; f < faces.size(); f++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                const int a = faces[f][k];
+                const int b = faces[f][(k + 1) % 3];
+                if (!isFeatureEdge(a, b))
+                    continue;
+                const Eigen::Vector3d edge = positions[b] - positions[a];
+                const Eigen::Vector3d n = getNormal(faces[f][0], faces[f][1], faces[f][2]);
+                const Eigen::Vector3d perpendicular = edge.cross(n);
+                if (perpendicular.norm() <= 0)
+                    continue;
+                const Eigen::Vector3d unit = perpendicular.normalized();
+                const Eigen::Vector4d plane(unit(0), unit(1), unit(2), -unit.dot(positions[a]));
+                const Eigen::Matrix4d q = DECIMATION_FEATURE_WEIGHT * edge.squaredNorm() * plane * plane.transpose();
+                quadrics[a] += q;
+                quadrics[b] += q;
+            }
+        }
+    }
+
+    // collapses edges until at most target_faces triangles are left or no legal collapse remains
+    void decimate(size_t target_faces)
+    {
+        heap = {};
+        for (size_t f = 0; f < faces.size(); f++)
+        {
+            if (!alive_face[f])
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                const int a = faces[f][k];
+                const int b = faces[f][(k + 1) % 3];
+                if (a < b)
+                    pushEdge(a, b);
+            }
+        }
+
+        while (num_faces > target_faces && !heap.empty())
+        {
+            const auto [cost, a, b, stamp_a, stamp_b, target] = heap.top();
+            heap.pop();
+            if (!alive_vertex[a] || !alive_vertex[b] || stamp[a] != stamp_a || stamp[b] != stamp_b)
+                continue;
+            if (!canCollapse(a, b, target))
+                continue;
+            collapse(a, b, target);
+        }
+    }
+
+    // the remaining mesh, compacted, with its per triangle neighbor materials
+    pair<pair<vector<Eigen::Vector3f>, vector<vector<int>>>, vector<int>> getMesh() const
+    {
+        vector<int> new_index(positions.size(), -1);
+        pair<vector<Eigen::Vector3f>, vector<vector<int>>> mesh;
+        vector<int> new_neighbors;
+        for (size_t f = 0; f < faces.size(); f++)
+        {
+            if (!alive_face[f])
+                continue;
+            vector<int> face;
+            for (const int v : faces[f])
+            {
+                if (new_index[v] == -1)
+                {
+                    new_index[v] = static_cast<int>(mesh.first.size());
+                    mesh.first.emplace_back(positions[v].cast<float>());
+                }
+                face.push_back(new_index[v]);
+            }
+            mesh.second.push_back(std::move(face));
+            new_neighbors.push_back(neighbors[f]);
+        }
+        return {mesh, new_neighbors};
+    }
+
+private:
+    // cost, a, b, stamp of a, stamp of b, new position
+    using edgeEntry = std::tuple<double, int, int, int, int, Eigen::Vector3d>;
+    struct edgeCompare
+    {
+        bool operator()(const edgeEntry &x, const edgeEntry &y) const { return std::get<0>(x) > std::get<0>(y); }
+    };
+
+    vector<Eigen::Vector3d> positions;
+    vector<Eigen::Matrix4d> quadrics;
+    vector<array<int, 3>> faces;
+    vector<int> neighbors;
+    vector<vector<int>> vertex_faces;
+    vector<bool> alive_vertex;
+    vector<bool> alive_face;
+    vector<int> stamp;
+    size_t num_faces = 0;
+    std::priority_queue<edgeEntry, vector<edgeEntry>, edgeCompare> heap;
+
+    Eigen::Vector3d getNormal(int a, int b, int c) const
+    {
+        return (positions[b] - positions[a]).cross(positions[c] - positions[a]);
+    }
+
+    // alive triangles containing both a and b
+    vector<int> getEdgeFaces(int a, int b) const
+    {
+        vector<int> result;
+        for (const int f : vertex_faces[a])
+        {
+            if (alive_face[f] && (faces[f][0] == b || faces[f][1] == b || faces[f][2] == b))
+                result.push_back(f);
+        }
+        return result;
+    }
+
+    bool isFeatureEdge(int a, int b) const
+    {
+        const vector<int> edge_faces = getEdgeFaces(a, b);
+        return edge_faces.size() != 2 || neighbors[edge_faces[0]] != neighbors[edge_faces[1]];
+    }
+
+    // number of feature edges at v: 0 inside a patch, 2 along a feature curve, anything else is a corner
+    int getFeatureDegree(int v) const
+    {
+        vector<int> ring;
+        for (const int f : vertex_faces[v])
+        {
+            if (!alive_face[f])
+                continue;
+            for (const int u : faces[f])
+            {
+                if (u != v)
+                    ring.push_back(u);
+            }
+        }
+        std::sort(ring.begin(), ring.end());
+        ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+        int degree = 0;
+        for (const int u : ring)
+        {
+            if (isFeatureEdge(v, u))
+                degree++;
+        }
+        return degree;
+    }
+
+    double getError(const Eigen::Matrix4d &q, const Eigen::Vector3d &p) const
+    {
+        const Eigen::Vector4d h(p(0), p(1), p(2), 1.0);
+        return std::max(0.0, h.dot(q * h));
+    }
+
+    void pushEdge(int a, int b)
+    {
+        const int degree_a = getFeatureDegree(a);
+        const int degree_b = getFeatureDegree(b);
+        const bool corner_a = degree_a != 0 && degree_a != 2;
+        const bool corner_b = degree_b != 0 && degree_b != 2;
+        // feature vertices only merge along their feature, and corners never move
+        if (degree_a != 0 && degree_b != 0 && (!isFeatureEdge(a, b) || (corner_a && corner_b)))
+            return;
+        const bool fixed_a = corner_a || (degree_a != 0 && degree_b == 0);
+        const bool fixed_b = corner_b || (degree_b != 0 && degree_a == 0);
+
+        const Eigen::Matrix4d q = quadrics[a] + quadrics[b];
+        vector<Eigen::Vector3d> candidates;
+        if (fixed_a)
+        {
+            candidates = {positions[a]};
+        }
+        else if (fixed_b)
+        {
+            candidates = {positions[b]};
+        }
+        else
+        {
+            candidates = {positions[a], positions[b], 0.5 * (positions[a] + positions[b])};
+            const Eigen::Matrix3d A = q.topLeftCorner<3, 3>();
+            const Eigen::Vector3d rhs = -q.topRightCorner<3, 1>();
+            if (std::abs(A.determinant()) > 1e-12)
+            {
+                const Eigen::Vector3d optimal = A.ldlt().solve(rhs);
+                // keep the solution close to the edge, far away minima come from nearly flat regions
+                const double length = (positions[b] - positions[a]).norm();
+                if ((optimal - 0.5 * (positions[a] + positions[b])).norm() <= length)
+                    candidates.push_back(optimal);
+            }
+        }
+
+        double best = std::numeric_limits<double>::infinity();
+        Eigen::Vector3d target;
+        for (const Eigen::Vector3d &p : candidates)
+        {
+            const double error = getError(q, p);
+            if (error < best)
+            {
+                best = error;
+                target = p;
+            }
+        }
+        heap.emplace(best, a, b, stamp[a], stamp[b], target);
+    }
+
+    bool canCollapse(int a, int b, const Eigen::Vector3d &target) const
+    {
+        // link condition: the only vertices adjacent to both are the tips of the edge's triangles
+        vector<int> link_a;
+        vector<int> link_b;
+        for (const int f : vertex_faces[a])
+            if (alive_face[f])
+                link_a.insert(link_a.end(), faces[f].begin(), faces[f].end());
+        for (const int f : vertex_faces[b])
+            if (alive_face[f])
+                link_b.insert(link_b.end(), faces[f].begin(), faces[f].end());
+        std::sort(link_a.begin(), link_a.end());
+        link_a.erase(std::unique(link_a.begin(), link_a.end()), link_a.end());
+        std::sort(link_b.begin(), link_b.end());
+        link_b.erase(std::unique(link_b.begin(), link_b.end()), link_b.end());
+        vector<int> shared;
+        std::set_intersection(link_a.begin(), link_a.end(), link_b.begin(), link_b.end(), std::back_inserter(shared));
+        const size_t tips = getEdgeFaces(a, b).size();
+        // shared holds a and b themselves plus the tips
+        if (shared.size() != tips + 2)
+            return false;
+
+        // no surviving triangle may flip or degenerate
+        for (const int v : {a, b})
+        {
+            for (const int f : vertex_faces[v])
+            {
+                if (!alive_face[f])
+                    continue;
+                const array<int, 3> &face = faces[f];
+                if (std::find(face.begin(), face.end(), a) != face.end() && std::find(face.begin(), face.end(), b) != face.end())
+                    continue;
+                const Eigen::Vector3d before = getNormal(face[0], face[1], face[2]);
+                array<Eigen::Vector3d, 3> moved;
+                for (int k = 0; k < 3; k++)
+                {
+                    moved[k] = face[k] == v ? target : positions[face[k]];
+                }
+                const Eigen::Vector3d after = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+                if (after.norm() <= 0 || before.norm() <= 0 ||
+                    before.normalized().dot(after.normalized()) < DECIMATION_MIN_NORMAL_DOT)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // merges b into a
+    void collapse(int a, int b, const Eigen::Vector3d &target)
+    {
+        for (const int f : vertex_faces[b])
+        {
+            if (!alive_face[f])
+                continue;
+            array<int, 3> &face = faces[f];
+            if (std::find(face.begin(), face.end(), a) != face.end())
+            {
+                alive_face[f] = false;
+                num_faces--;
+                continue;
+            }
+            std::replace(face.begin(), face.end(), b, a);
+            vertex_faces[a].push_back(f);
+        }
+        alive_vertex[b] = false;
+        vertex_faces[b].clear();
+        positions[a] = target;
+        quadrics[a] += quadrics[b];
+        stamp[a]++;
+
+        // drop dead triangles and requeue the edges around a
+        vector<int> &around = vertex_faces[a];
+        around.erase(std::remove_if(around.begin(), around.end(), [this](int f)
+                                    { return !alive_face[f]; }),
+                     around.end());
+        vector<int> ring;
+        for (const int f : around)
+        {
+            for (const int v : faces[f])
+            {
+                if (v != a)
+                    ring.push_back(v);
+            }
+        }
+        std::sort(ring.begin(), ring.end());
+        ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+        for (const int v : ring)
+        {
+            pushEdge(std::min(a, v), std::max(a, v));
+        }
+    }
+};
+
+// Levels of detail for every material, level i keeps about ratios[i] of the original triangles, each ratio is in
+// (0, 1], see the meshLODs check in main.cpp.
+// Each level is decimated from the previous one, the materials are processed in parallel.
+// Returns [level][material] meshes and the matching per triangle neighbor materials.
+inline pair<vector<vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>>>, vector<vector<vector<int>>>>
+getMeshLODs(const vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> &meshes,
+            const vector<renderMesh> &render,
+            const vector<float> &ratios)
+{
+    vector<vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>>> levels(
+        ratios.size(), vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>>(meshes.size()));
+    vector<vector<vector<int>>> level_neighbors(ratios.size(), vector<vector<int>>(meshes.size()));
+
+    parallelFor(meshes.size(), [&](size_t m)
+                {
+        meshDecimator decimator(meshes[m], render[m].neighbors);
+        for (size_t level = 0; level < ratios.size(); level++)
+        {
+            decimator.decimate(static_cast<size_t>(ratios[level] * meshes[m].second.size()));
+            std::tie(levels[level][m], level_neighbors[level][m]) = decimator.getMesh();
+        } });
+
+    return {levels, level_neighbors};
+}
+
+#endif //ST_VISUALIZER_MESHSIMPLIFY_H
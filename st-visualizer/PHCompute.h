@@ -14,9 +14,12 @@
 #include <iomanip>
 #include <stack>
 #include <set>
+#include <functional>
 
 #include <Eigen/Eigen>
 
+#include "Contour2D.h"
+
 #include <phat/compute_persistence_pairs.h>
 #include <phat/boundary_matrix.h>
 #include <phat/representations/default_representations.h>
@@ -231,18 +234,40 @@ void boundary_matrix_diagnose(const phat::boundary_matrix<ColumnType> &boundary_
 }
 
 
-void compute_ph(const vector<vector<float>> &materials, const vector<vector<int>> &tets)
+extern bool ph_simplify;
+extern float ph_threshold;
+
+// a persistence pair of the material filtration, with the simplices that create and destroy the feature
+struct ph_pair
 {
-    int num_materials = materials[0].size();
-    int num_points = materials.size();
+    int dimension;
+    float birth;
+    float death;
+    vector<int> birth_simplex;
+    vector<int> death_simplex;
+};
+
+// the edges and triangles of the tetrahedral mesh, shared by the filtrations of all materials
+struct ph_complex
+{
+    vector<vector<int>> edges;
+    vector<vector<int>> triangles;
+};
 
-    const vector<vector<int>> edge_combinations = {{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}};
-    const vector<vector<int>> triangle_combinations = {{0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}};
+// tets may also be the triangles of a 2D mesh
+ph_complex get_ph_complex(const vector<vector<int>> &tets)
+{
+    const bool is_2d = !tets.empty() && tets[0].size() == 3;
+    const vector<vector<int>> edge_combinations = is_2d
+        ? vector<vector<int>>({{0, 1}, {0, 2}, {1, 2}})
+        : vector<vector<int>>({{0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3}});
+    const vector<vector<int>> triangle_combinations = is_2d
+        ? vector<vector<int>>({{0, 1, 2}})
+        : vector<vector<int>>({{0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}});
 
     // FIXME: why didn't the simplex hash work?
     unordered_map<vector<int>, bool, SimplexHash, SimplexEqual> simplex_visited;
-    vector<vector<int>> edges;
-    vector<vector<int>> triangles;
+    ph_complex complex;
 
     for (vector<int> tet : tets)
     {
@@ -255,7 +280,7 @@ void compute_ph(const vector<vector<float>> &materials, const vector<vector<int>
             const vector<int> edge = {tet[combination[0]], tet[combination[1]]};
             if (!simplex_visited[edge])
             {
-                edges.push_back(edge);
+                complex.edges.push_back(edge);
                 simplex_visited[edge] = true;
             }
         }
@@ -268,128 +293,361 @@ void compute_ph(const vector<vector<float>> &materials, const vector<vector<int>
             const vector<int> triangle = {tet[combination[0]], tet[combination[1]], tet[combination[2]]};
             if (!simplex_visited[triangle])
             {
-                triangles.push_back(triangle);
+                complex.triangles.push_back(triangle);
                 simplex_visited[triangle] = true;
             }
         }
     }
 
-    std::cout << "there are " << num_points << " points, " << edges.size() << " edges, " << triangles.size() << " triangles, " << tets.size() << " tets in filtratiion" << std::endl;
+    return complex;
+}
+
+// determine the material specific alpha values for each point
+// points of the material have alpha below 1, the rest have alpha above 1
+vector<float> get_material_alphas(const vector<vector<float>> &materials, const materialArgmax &argmax, int material_idx)
+{
+    int num_points = materials.size();
+    vector<float> alphas(num_points);
+
+    for (int i = 0; i < num_points; i++)
+    {
+        float alpha;
+        if (material_idx == argmax.primary[i])
+        {
+            alpha = argmax.top[i] - argmax.second[i];
+        } else
+        {
+            alpha = materials[i][material_idx] - argmax.top[i];
+        }
+        alphas[i] = 1 - alpha;
+    }
+
+    return alphas;
+}
 
-    // tuple: largest value, second largest value, index of largest value
-    vector<tuple<float, float, int>> points_properties(num_points);
+vector<tuple<vector<int>, float>> get_filtration(const ph_complex &complex, const vector<vector<int>> &tets, const vector<float> &alphas)
+{
+    int num_points = alphas.size();
+    vector<tuple<vector<int>, float>> filtration;
+    filtration.reserve(num_points + complex.edges.size() + complex.triangles.size() + tets.size());
 
+    // insert points to filtration
     for (int i = 0; i < num_points; i++)
     {
-        const vector<float> &values = materials[i];
+        filtration.push_back({{i}, alphas[i]});
+    }
+
+    // insert edges to filtration
+    for (const vector<int> &edge : complex.edges)
+    {
+        filtration.push_back({edge, get_alpha(edge, alphas)});
+    }
+
+    // insert triangles to filtration
+    for (const vector<int> &triangle : complex.triangles)
+    {
+        filtration.push_back({triangle, get_alpha(triangle, alphas)});
+    }
+
+    // insert tets to filtration
+    for (const vector<int> &tet : tets)
+    {
+        filtration.push_back({tet, get_alpha(tet, alphas)});
+    }
+
+    std::sort(filtration.begin(), filtration.end(), compare_alpha);
+    return filtration;
+}
+
+// reduce the boundary matrix of a sorted filtration and return its persistence pairs
+vector<ph_pair> get_persistence_pairs(vector<tuple<vector<int>, float>> &filtration, bool diagnose)
+{
+    int num_simplices = filtration.size();
+
+    unordered_map<vector<int>, int, SimplexHash, SimplexEqual> simplex_to_ind;
+    for (int i = 0; i < filtration.size(); i++)
+    {
+        vector<int> &simplex = std::get<0>(filtration[i]);
+        simplex_to_ind[simplex] = i;
+    }
+
+    // initialize boundary matrix
+    phat::boundary_matrix<phat::sparse_pivot_column> boundary_matrix;
+    boundary_matrix.set_num_cols(num_simplices);
+
+    for (int i = 0; i < num_simplices; i++)
+    {
+        tuple<vector<int>, float> &tuple = filtration[i];
+        vector<int> &simplex = std::get<0>(tuple);
+        int dimension = simplex.size() - 1;
+        vector<phat::index> boundary_idx = get_boundary_idx(simplex, simplex_to_ind);
+        std::sort(boundary_idx.begin(), boundary_idx.end());
+        boundary_matrix.set_col(i, boundary_idx);
+        boundary_matrix.set_dim(i, dimension);
+    }
+
+    if (diagnose)
+    {
+        boundary_matrix_diagnose(boundary_matrix, filtration, simplex_to_ind);
+    }
+
+    phat::persistence_pairs pairs;
+    phat::compute_persistence_pairs< phat::standard_reduction >( pairs, boundary_matrix );
+    pairs.sort();
+
+    vector<ph_pair> result;
+    result.reserve(pairs.get_num_pairs());
+    for (phat::index idx = 0; idx < pairs.get_num_pairs(); idx++)
+    {
+        const auto [birth, death] = pairs.get_pair(idx);
+        const vector<int> &birth_simplex = std::get<0>(filtration[birth]);
+        const vector<int> &death_simplex = std::get<0>(filtration[death]);
+        result.push_back({static_cast<int>(birth_simplex.size()) - 1,
+                          std::get<1>(filtration[birth]),
+                          std::get<1>(filtration[death]),
+                          birth_simplex,
+                          death_simplex});
+    }
+
+    return result;
+}
+
+void print_pairs(const vector<ph_pair> &pairs)
+{
+    std::cout << std::endl;
+    std::cout << "There are " << pairs.size() << " persistence pairs: " << std::endl;
+    for (const ph_pair &pair : pairs)
+        std::cout << "Birth: " << pair.birth << ", Death: " << pair.death << ", Dimension: " << pair.dimension << std::endl;
+}
+
+// persistence pairs of one material on the complex of tets (or triangles, with tets empty)
+vector<ph_pair> get_material_pairs(const vector<vector<float>> &materials, const materialArgmax &argmax, const ph_complex &complex,
+                                   const vector<vector<int>> &tets, int material_idx, bool diagnose)
+{
+    const vector<float> alphas = get_material_alphas(materials, argmax, material_idx);
+    vector<tuple<vector<int>, float>> filtration = get_filtration(complex, tets, alphas);
+    if (diagnose)
+    {
+        print_filtration(filtration, false, true);
+    }
+    return get_persistence_pairs(filtration, diagnose);
+}
 
-        float largest = std::numeric_limits<float>::lowest();
-        float second_largest = std::numeric_limits<float>::lowest();
-        int largest_index = -1;
+// persistence pairs of every material except the last one (no tissue)
+vector<vector<ph_pair>> get_materials_pairs(const vector<vector<float>> &materials, const materialArgmax &argmax, const ph_complex &complex,
+                                            const vector<vector<int>> &tets)
+{
+    int num_materials = materials[0].size();
+    vector<vector<ph_pair>> result;
+    for (int material_idx = 0; material_idx < num_materials - 1; material_idx++)
+    {
+        result.push_back(get_material_pairs(materials, argmax, complex, tets, material_idx, false));
+    }
+    return result;
+}
 
-        for (int j = 0; j < num_materials; j++)
+// pairs, if given, are the persistence pairs of the same materials computed before, e.g. by simplify_materials,
+// and are reported instead of reducing the filtrations again
+vector<vector<ph_pair>> compute_ph(const vector<vector<float>> &materials, const materialArgmax &argmax, const vector<vector<int>> &tets,
+                                   const vector<vector<ph_pair>> *pairs = nullptr)
+{
+    if (pairs)
+    {
+        for (const vector<ph_pair> &material_pairs : *pairs)
         {
-            if (values[j] > largest)
-            {
-                second_largest = largest;
-                largest = values[j];
-                largest_index = j;
-            } else if (values[j] > second_largest && values[j] != largest)
-            {
-                second_largest = values[j];
-            }
+            print_pairs(material_pairs);
         }
-
-        points_properties[i] = {largest, second_largest, largest_index};
+        return *pairs;
     }
 
+    int num_materials = materials[0].size();
+    int num_points = materials.size();
+
+    const ph_complex complex = get_ph_complex(tets);
+
+    std::cout << "there are " << num_points << " points, " << complex.edges.size() << " edges, " << complex.triangles.size() << " triangles, " << tets.size() << " tets in filtratiion" << std::endl;
+
     // compute persistent homology for each material except the last one (no tissue)
+    vector<vector<ph_pair>> result;
     for (int material_idx = 0; material_idx < num_materials - 1; material_idx++)
     {
-        vector<tuple<vector<int>, float>> filtration;
-        vector<float> alphas(num_points);
+        vector<ph_pair> material_pairs = get_material_pairs(materials, argmax, complex, tets, material_idx, true);
+        print_pairs(material_pairs);
 
-        // determine the material specific alpha values for each point
-        for (int i = 0; i < num_points; i++)
-        {
-            const vector<float> &values = materials[i];
-            tuple<float, float, int> &point_properties = points_properties[i];
+        result.push_back(std::move(material_pairs));
+    }
 
-            float alpha;
-            if (material_idx == std::get<2>(point_properties))
-            {
-                alpha = std::get<0>(point_properties) - std::get<1>(point_properties);
-            } else
+    return result;
+}
+
+// persistent homology of each material on the triangle mesh of a single slice
+// pairs with zero persistence are dropped
+vector<vector<ph_pair>> compute_section_ph(const vector<vector<float>> &materials, const materialArgmax &argmax, const vector<vector<int>> &tris)
+{
+    vector<vector<ph_pair>> result = get_materials_pairs(materials, argmax, get_ph_complex(tris), {});
+    for (vector<ph_pair> &pairs : result)
+    {
+        std::erase_if(pairs, [](const ph_pair &pair)
+                      { return pair.birth == pair.death; });
+    }
+    return result;
+}
+
+// per slice, per material persistence pairs, the slices are computed in parallel
+vector<vector<vector<ph_pair>>> compute_sections_ph(const vector<vector<vector<float>>> &vals, const vector<materialArgmax> &argmax, const vector<vector<vector<int>>> &section_tris)
+{
+    log("Computing slice persistent homology.");
+    return mapVectorParallel(vals, std::function([&argmax, &section_tris](const vector<vector<float>> &materials, size_t i)
+                                                 { return compute_section_ph(materials, argmax[i], section_tris[i]); }));
+}
+
+// per slice, per material [dimension, birth, death] of every pair, the part of the pairs written to the results
+vector<vector<vector<tuple<int, float, float>>>> get_sections_ph_entries(const vector<vector<vector<ph_pair>>> &sections)
+{
+    vector<vector<vector<tuple<int, float, float>>>> result(sections.size());
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        for (const vector<ph_pair> &pairs : sections[i])
+        {
+            vector<tuple<int, float, float>> &entries = result[i].emplace_back();
+            for (const ph_pair &pair : pairs)
             {
-                alpha = values[material_idx] - std::get<0>(point_properties);
+                entries.emplace_back(pair.dimension, pair.birth, pair.death);
             }
-            alphas[i] = 1 - alpha;
         }
+    }
+    return result;
+}
+
+// Cancel the features of each material whose persistence falls below the threshold, by changing the primary
+// material of the points that carry them. The materials are simplified in turn, and the pairs of a material are
+// computed from the values left by the materials before it. Islands (dimension 0) are handed to the points' next
+// best material. Tunnels and cavities (dimension 1 and 2) are filled by making the material primary at the points
+// outside it that enter the filtration before the feature dies and are connected to the killing simplex, which is
+// the material around a cavity, or the disk spanning a tunnel where it does not cross the material itself.
+// Only features alive at alpha 1, the level at which the material is contoured, are affected.
+// pairs receives the persistence pairs of the simplified materials, see compute_ph.
+// Returns the number of cancelled features.
+int simplify_materials(vector<vector<float>> &materials, const ph_complex &complex, const vector<vector<int>> &tets,
+                       float threshold, vector<vector<ph_pair>> &pairs)
+{
+    int num_materials = materials[0].size();
+    int num_points = materials.size();
+    int cancelled = 0;
 
-        // insert points to filtration
-        for (int i = 0; i < num_points; i++)
+    vector<vector<int>> neighbors(num_points);
+    for (const vector<int> &edge : complex.edges)
+    {
+        neighbors[edge[0]].push_back(edge[1]);
+        neighbors[edge[1]].push_back(edge[0]);
+    }
+
+    // swap the values of two materials at a point, which keeps the value set but changes the primary material
+    auto swap_materials = [&materials](int point, int a, int b)
+    {
+        std::swap(materials[point][a], materials[point][b]);
+    };
+
+    // the points connected to the starts through points that pass inside, every flood has its own stamp
+    vector<int> visited(num_points, -1);
+    int flood_idx = 0;
+    auto flood = [&](const vector<int> &starts, const std::function<bool(int)> &inside)
+    {
+        vector<int> region;
+        stack<int> pending;
+        for (int start : starts)
         {
-            filtration.push_back({{i}, alphas[i]});
+            if (visited[start] != flood_idx && inside(start))
+            {
+                visited[start] = flood_idx;
+                pending.push(start);
+            }
         }
-
-        // insert edges to filtration
-        for (vector<int> edge : edges)
+        while (!pending.empty())
         {
-            filtration.push_back({edge, get_alpha(edge, alphas)});
+            const int current = pending.top();
+            pending.pop();
+            region.push_back(current);
+            for (int neighbor : neighbors[current])
+            {
+                if (visited[neighbor] != flood_idx && inside(neighbor))
+                {
+                    visited[neighbor] = flood_idx;
+                    pending.push(neighbor);
+                }
+            }
         }
+        flood_idx++;
+        return region;
+    };
 
-        // insert triangles to filtration
-        for (vector<int> triangle : triangles)
+    // every material except the last one (no tissue)
+    pairs.assign(num_materials - 1, {});
+    int last_changed = -1;
+    for (int material_idx = 0; material_idx < num_materials - 1; material_idx++)
+    {
+        // the values change with every simplified material
+        const materialArgmax argmax = getMaterialArgmax(materials);
+        const vector<float> alphas = get_material_alphas(materials, argmax, material_idx);
+        pairs[material_idx] = get_material_pairs(materials, argmax, complex, tets, material_idx, false);
+        auto is_primary = [&](int point)
         {
-            filtration.push_back({triangle, get_alpha(triangle, alphas)});
-        }
+            return getMaxPos(materials[point]) == material_idx;
+        };
 
-        // insert tets to filtration
-        for (vector<int> tet : tets)
+        for (const ph_pair &pair : pairs[material_idx])
         {
-            filtration.push_back({tet, get_alpha(tet, alphas)});
-        }
+            if (pair.death - pair.birth >= threshold || pair.birth >= 1 || pair.death < 1)
+            {
+                continue;
+            }
 
-        int num_simplices = filtration.size();
-        std::sort(filtration.begin(), filtration.end(), compare_alpha);
-        print_filtration(filtration, false, true);
+            vector<int> region;
+            if (pair.dimension == 0)
+            {
+                // flood the island from its birth vertex and give its points away
+                region = flood(pair.birth_simplex, is_primary);
+                for (int point : region)
+                {
+                    vector<float> others = materials[point];
+                    others[material_idx] = std::numeric_limits<float>::lowest();
+                    swap_materials(point, material_idx, getMaxPos(others));
+                }
+            }
+            else
+            {
+                // the loop or shell was given away as part of an island
+                if (!std::all_of(pair.birth_simplex.begin(), pair.birth_simplex.end(), is_primary))
+                {
+                    continue;
+                }
+                region = flood(pair.death_simplex, [&](int p)
+                               { return alphas[p] >= 1 && alphas[p] <= pair.death && !is_primary(p); });
+                for (int point : region)
+                {
+                    swap_materials(point, material_idx, getMaxPos(materials[point]));
+                }
+            }
 
-        unordered_map<vector<int>, int, SimplexHash, SimplexEqual> simplex_to_ind;
-        for (int i = 0; i < filtration.size(); i++)
-        {
-            vector<int> &simplex = std::get<0>(filtration[i]);
-            simplex_to_ind[simplex] = i;
+            if (!region.empty())
+            {
+                cancelled++;
+                last_changed = material_idx;
+            }
         }
+    }
 
-        // initialize boundary matrix
-        phat::boundary_matrix<phat::sparse_pivot_column> boundary_matrix;
-        boundary_matrix.set_num_cols(num_simplices);
-
-        for (int i = 0; i < num_simplices; i++)
+    // the pairs of a material are stale once it or a later material changed the values
+    if (last_changed >= 0)
+    {
+        const materialArgmax argmax = getMaterialArgmax(materials);
+        for (int material_idx = 0; material_idx <= last_changed; material_idx++)
         {
-            tuple<vector<int>, float> &tuple = filtration[i];
-            vector<int> &simplex = std::get<0>(tuple);
-            int dimension = simplex.size() - 1;
-            vector<phat::index> boundary_idx = get_boundary_idx(simplex, simplex_to_ind);
-            std::sort(boundary_idx.begin(), boundary_idx.end());
-            boundary_matrix.set_col(i, boundary_idx);
-            boundary_matrix.set_dim(i, dimension);
+            pairs[material_idx] = get_material_pairs(materials, argmax, complex, tets, material_idx, false);
         }
-
-        boundary_matrix_diagnose(boundary_matrix, filtration, simplex_to_ind);
-
-        phat::persistence_pairs pairs;
-        phat::compute_persistence_pairs< phat::standard_reduction >( pairs, boundary_matrix );
-        pairs.sort();
-
-        // print the pairs:
-        std::cout << std::endl;
-        std::cout << "There are " << pairs.get_num_pairs() << " persistence pairs: " << std::endl;
-        for( phat::index idx = 0; idx < pairs.get_num_pairs(); idx++ )
-            std::cout << "Birth: " << pairs.get_pair( idx ).first << ", Death: " << pairs.get_pair( idx ).second << std::endl;
     }
 
-
+    return cancelled;
 }
 
 #endif //ST_VISUALIZER_PHCOMPUTE_H
@@ -0,0 +1,508 @@
+#ifndef ST_VISUALIZER_PHCUBICAL_H
+#define ST_VISUALIZER_PHCUBICAL_H
+
+#include "PHCompute.h"
+#include "UtilityFunctions.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::array;
+using std::pair;
+using std::string;
+using std::vector;
+
+// A grayscale 2D or 3D image, x varies fastest. 2D images have a depth of 1.
+struct cubical_image
+{
+    array<int64_t, 3> shape = {1, 1, 1};
+    vector<float> voxels;
+};
+
+template <typename T>
+vector<float> read_voxels(std::ifstream &file, size_t count)
+{
+    vector<T> raw(count);
+    file.read(reinterpret_cast<char *>(raw.data()), static_cast<std::streamsize>(count * sizeof(T)));
+    if (file.gcount() != static_cast<std::streamsize>(count * sizeof(T)))
+    {
+        throw std::runtime_error("Image file is smaller than its dimensions");
+    }
+    return vector<float>(raw.begin(), raw.end());
+}
+
+inline vector<float> read_voxels(std::ifstream &file, size_t count, const string &data_type)
+{
+    if (data_type == "uint8")
+        return read_voxels<uint8_t>(file, count);
+    if (data_type == "int8")
+        return read_voxels<int8_t>(file, count);
+    if (data_type == "uint16")
+        return read_voxels<uint16_t>(file, count);
+    if (data_type == "int16")
+        return read_voxels<int16_t>(file, count);
+    if (data_type == "float32")
+        return read_voxels<float>(file, count);
+    throw std::runtime_error("Unsupported image data type: " + data_type);
+}
+
+inline void check_image_shape(const array<int64_t, 3> &shape)
+{
+    if (std::any_of(shape.begin(), shape.end(), [](int64_t size)
+                    { return size <= 0; }))
+    {
+        throw std::runtime_error("Image dimensions must be positive");
+    }
+    // see compute_cubical_ph, this also keeps the voxel count and byte size from overflowing
+    if (shape[0] * shape[1] >= std::numeric_limits<uint32_t>::max() / shape[2])
+    {
+        throw std::runtime_error("Images with 2^32 voxels or more are not supported");
+    }
+}
+
+// Headerless little-endian voxel array, e.g. a decoded PNG
+inline cubical_image load_raw_image(const string &path, const vector<int64_t> &shape, const string &data_type)
+{
+    if (shape.size() < 2 || shape.size() > 3)
+    {
+        throw std::runtime_error("Image shape must have 2 or 3 dimensions");
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    cubical_image image;
+    std::copy(shape.begin(), shape.end(), image.shape.begin());
+    check_image_shape(image.shape);
+    image.voxels = read_voxels(file, image.shape[0] * image.shape[1] * image.shape[2], data_type);
+    return image;
+}
+
+// MRC/CCP4 volume, the 1024 byte header is followed by an optional extended header and the voxels.
+// Only little-endian files are read, as told by the machine stamp at byte 212, files without a stamp are taken
+// to be little-endian.
+inline cubical_image load_mrc_image(const string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    std::array<int32_t, 256> header = {};
+    file.read(reinterpret_cast<char *>(header.data()), sizeof(header));
+    if (file.gcount() != sizeof(header))
+    {
+        throw std::runtime_error("Invalid MRC header");
+    }
+
+    // 0x44 0x44 or 0x44 0x41 for little-endian, 0x11 0x11 for big-endian
+    const auto *stamp = reinterpret_cast<const unsigned char *>(&header[53]);
+    if (stamp[0] != 0x44 && (stamp[0] != 0 || stamp[1] != 0))
+    {
+        throw std::runtime_error("Only little-endian MRC files are supported");
+    }
+
+    cubical_image image;
+    image.shape = {header[0], header[1], header[2]};
+    check_image_shape(image.shape);
+    const int32_t mode = header[3];
+    const int32_t extended_header = header[23];
+    const size_t count = image.shape[0] * image.shape[1] * image.shape[2];
+
+    // bytes per voxel of the supported modes
+    const std::map<int32_t, size_t> voxel_sizes = {{0, 1}, {1, 2}, {2, 4}, {6, 2}};
+    const auto voxel_size = voxel_sizes.find(mode);
+    if (voxel_size == voxel_sizes.end())
+    {
+        throw std::runtime_error("Unsupported MRC mode " + std::to_string(mode));
+    }
+    if (extended_header < 0)
+    {
+        throw std::runtime_error("Invalid MRC extended header size");
+    }
+    if (1024 + static_cast<uintmax_t>(extended_header) + count * voxel_size->second > std::filesystem::file_size(path))
+    {
+        throw std::runtime_error("Image file is smaller than its dimensions");
+    }
+    file.seekg(1024 + extended_header, std::ios::beg);
+
+    switch (mode)
+    {
+    case 0:
+        image.voxels = read_voxels<int8_t>(file, count);
+        break;
+    case 1:
+        image.voxels = read_voxels<int16_t>(file, count);
+        break;
+    case 2:
+        image.voxels = read_voxels<float>(file, count);
+        break;
+    case 6:
+        image.voxels = read_voxels<uint16_t>(file, count);
+        break;
+    }
+    return image;
+}
+
+// Persistent homology of the lower-star filtration of an image.
+// The cubical complex is never listed explicitly: cells live on the doubled grid (a coordinate is odd along the
+// axes the cell spans), a cell's value is the max of its voxels, and its faces and cofaces are its neighbours along
+// the odd and even axes. Cells are ordered by the rank of their highest voxel, then by dimension, then by index,
+// so the filtration follows from the voxel order alone. Dimension 0 is a union-find over the voxels. The higher
+// dimensions reduce the coboundary matrix one column at a time with clearing, and only keep the columns that are
+// not apparent pairs, so the memory stays at a few bytes per cell besides those.
+// Pairs with zero persistence are dropped, essential classes die at infinity.
+// The birth and death simplices of each pair hold the doubled grid coordinates of the creating and killing cells.
+inline vector<ph_pair> compute_cubical_ph(const cubical_image &image)
+{
+    const int64_t num_voxels = image.shape[0] * image.shape[1] * image.shape[2];
+    if (num_voxels >= static_cast<int64_t>(std::numeric_limits<uint32_t>::max()))
+    {
+        throw std::runtime_error("Images with 2^32 voxels or more are not supported");
+    }
+
+    array<int64_t, 3> grid{};
+    array<int64_t, 3> stride{};
+    int64_t num_cells = 1;
+    int num_axes = 0;
+    for (int a = 0; a < 3; a++)
+    {
+        grid[a] = 2 * image.shape[a] - 1;
+        stride[a] = num_cells;
+        num_cells *= grid[a];
+        num_axes += grid[a] > 1;
+    }
+
+    auto get_coords = [&grid](int64_t cell) -> array<int64_t, 3>
+    {
+        return {cell % grid[0], (cell / grid[0]) % grid[1], cell / (grid[0] * grid[1])};
+    };
+    auto get_cell = [&stride](const array<int64_t, 3> &coords)
+    {
+        return coords[0] * stride[0] + coords[1] * stride[1] + coords[2] * stride[2];
+    };
+    auto get_voxel = [&image](const array<int64_t, 3> &coords)
+    {
+        return coords[0] / 2 + image.shape[0] * (coords[1] / 2 + image.shape[1] * (coords[2] / 2));
+    };
+
+    // voxel order: by value, then index
+    vector<uint32_t> order(num_voxels);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&image](uint32_t a, uint32_t b)
+              { return std::tie(image.voxels[a], a) < std::tie(image.voxels[b], b); });
+    vector<uint32_t> rank(num_voxels);
+    for (int64_t i = 0; i < num_voxels; i++)
+    {
+        rank[order[i]] = static_cast<uint32_t>(i);
+    }
+
+    // filtration key of a cell, the rank of its highest voxel and its index
+    using cell_key = pair<uint32_t, int64_t>;
+    auto get_key = [&](int64_t cell) -> cell_key
+    {
+        const array<int64_t, 3> coords = get_coords(cell);
+        uint32_t highest = 0;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            array<int64_t, 3> vertex = coords;
+            bool valid = true;
+            for (int a = 0; a < 3; a++)
+            {
+                if (coords[a] & 1)
+                    vertex[a] += (corner >> a) & 1 ? 1 : -1;
+                else
+                    valid &= ((corner >> a) & 1) == 0;
+            }
+            if (valid)
+                highest = std::max(highest, rank[get_voxel(vertex)]);
+        }
+        return {highest, cell};
+    };
+    auto get_value = [&](const cell_key &key)
+    {
+        return image.voxels[order[key.first]];
+    };
+    auto get_dim = [](const array<int64_t, 3> &coords)
+    {
+        return static_cast<int>((coords[0] & 1) + (coords[1] & 1) + (coords[2] & 1));
+    };
+    auto get_cell_simplex = [&get_coords](int64_t cell)
+    {
+        const array<int64_t, 3> coords = get_coords(cell);
+        return vector<int>(coords.begin(), coords.end());
+    };
+
+    // the cells of dimension dim whose highest voxel is voxel, in decreasing index order
+    auto get_lower_star = [&](uint32_t voxel, int dim)
+    {
+        const array<int64_t, 3> center = {2 * (voxel % image.shape[0]), 2 * ((voxel / image.shape[0]) % image.shape[1]),
+                                          2 * (voxel / (image.shape[0] * image.shape[1]))};
+        vector<int64_t> cells;
+        for (int offsets = 0; offsets < 27; offsets++)
+        {
+            array<int64_t, 3> coords = center;
+            bool valid = true;
+            for (int a = 0, code = offsets; a < 3; a++, code /= 3)
+            {
+                coords[a] += code % 3 - 1;
+                valid &= coords[a] >= 0 && coords[a] < grid[a];
+            }
+            if (valid && get_dim(coords) == dim)
+            {
+                const int64_t cell = get_cell(coords);
+                if (get_key(cell).first == rank[voxel])
+                    cells.push_back(cell);
+            }
+        }
+        std::sort(cells.rbegin(), cells.rend());
+        return cells;
+    };
+    auto get_cofaces = [&](int64_t cell, vector<int64_t> &cofaces)
+    {
+        const array<int64_t, 3> coords = get_coords(cell);
+        cofaces.clear();
+        for (int a = 0; a < 3; a++)
+        {
+            if (coords[a] & 1)
+                continue;
+            if (coords[a] > 0)
+                cofaces.push_back(cell - stride[a]);
+            if (coords[a] + 1 < grid[a])
+                cofaces.push_back(cell + stride[a]);
+        }
+    };
+    // the facet of cell that enters the filtration last
+    auto get_last_facet = [&](int64_t cell)
+    {
+        const array<int64_t, 3> coords = get_coords(cell);
+        cell_key last = {0, -1};
+        for (int a = 0; a < 3; a++)
+        {
+            if (coords[a] & 1)
+            {
+                last = std::max({last, get_key(cell - stride[a]), get_key(cell + stride[a])});
+            }
+        }
+        return last.second;
+    };
+
+    vector<ph_pair> result;
+
+    // dimension 0: components merge at the edges, the younger one dies. The killing edges are cleared from
+    // the reduction of dimension 1.
+    log("Reducing cubical complex with ", num_cells, " cells.");
+    vector<bool> cleared(num_cells, false);
+    {
+        vector<uint32_t> parent(num_voxels);
+        std::iota(parent.begin(), parent.end(), 0);
+        auto find = [&parent](uint32_t voxel)
+        {
+            while (parent[voxel] != voxel)
+            {
+                parent[voxel] = parent[parent[voxel]];
+                voxel = parent[voxel];
+            }
+            return voxel;
+        };
+        for (int64_t i = 0; i < num_voxels; i++)
+        {
+            const uint32_t voxel = order[i];
+            vector<int64_t> edges = get_lower_star(voxel, 1);
+            std::reverse(edges.begin(), edges.end());
+            for (int64_t edge : edges)
+            {
+                const array<int64_t, 3> coords = get_coords(edge);
+                const int axis = (coords[0] & 1) ? 0 : ((coords[1] & 1) ? 1 : 2);
+                const uint32_t a = find(static_cast<uint32_t>(get_voxel(get_coords(edge - stride[axis]))));
+                const uint32_t b = find(static_cast<uint32_t>(get_voxel(get_coords(edge + stride[axis]))));
+                if (a == b)
+                    continue;
+                // the root of a component is its lowest voxel
+                const uint32_t older = rank[a] < rank[b] ? a : b;
+                const uint32_t younger = older == a ? b : a;
+                parent[younger] = older;
+                cleared[edge] = true;
+                if (image.voxels[younger] != image.voxels[voxel])
+                {
+                    result.push_back({0, image.voxels[younger], image.voxels[voxel],
+                                      get_cell_simplex(get_cell({2 * (younger % image.shape[0]),
+                                                                 2 * ((younger / image.shape[0]) % image.shape[1]),
+                                                                 2 * (younger / (image.shape[0] * image.shape[1]))})),
+                                      get_cell_simplex(edge)});
+                }
+            }
+        }
+        const uint32_t lowest = order[0];
+        result.push_back({0, image.voxels[lowest], std::numeric_limits<float>::infinity(),
+                          get_cell_simplex(get_cell({2 * (lowest % image.shape[0]),
+                                                     2 * ((lowest / image.shape[0]) % image.shape[1]),
+                                                     2 * (lowest / (image.shape[0] * image.shape[1]))})),
+                          {}});
+    }
+
+    // dimensions 1 and up: the columns are the cells of dim in decreasing filtration order, and the pivot of a column
+    // is its earliest coface. A column whose pivot is taken gets the column that took it added. Columns that are an
+    // apparent pair, where the column is the last facet of its pivot, are found again from the pivot and not kept.
+    for (int dim = 1; dim < num_axes; dim++)
+    {
+        vector<bool> pivots(num_cells, false);
+        unordered_map<int64_t, vector<int64_t>> kept_columns;
+        std::priority_queue<cell_key, vector<cell_key>, std::greater<cell_key>> column;
+        vector<int64_t> cofaces;
+        vector<int64_t> added;
+
+        auto add_cofaces = [&](int64_t cell)
+        {
+            get_cofaces(cell, cofaces);
+            for (int64_t coface : cofaces)
+            {
+                column.push(get_key(coface));
+            }
+        };
+        // the earliest coface left once equal entries cancel out, or -1
+        auto get_pivot = [&column]() -> cell_key
+        {
+            while (!column.empty())
+            {
+                const cell_key top = column.top();
+                column.pop();
+                if (!column.empty() && column.top() == top)
+                {
+                    column.pop();
+                    continue;
+                }
+                column.push(top);
+                return top;
+            }
+            return {0, -1};
+        };
+
+        for (int64_t i = num_voxels - 1; i >= 0; i--)
+        {
+            for (int64_t cell : get_lower_star(order[i], dim))
+            {
+                if (cleared[cell])
+                    continue;
+                const cell_key key = {static_cast<uint32_t>(i), cell};
+                column = {};
+                added.clear();
+                add_cofaces(cell);
+                while (true)
+                {
+                    const cell_key pivot = get_pivot();
+                    if (pivot.second == -1)
+                    {
+                        result.push_back({dim, get_value(key), std::numeric_limits<float>::infinity(),
+                                          get_cell_simplex(cell), {}});
+                        break;
+                    }
+                    if (!pivots[pivot.second])
+                    {
+                        pivots[pivot.second] = true;
+                        if (get_value(key) != get_value(pivot))
+                        {
+                            result.push_back({dim, get_value(key), get_value(pivot),
+                                              get_cell_simplex(cell), get_cell_simplex(pivot.second)});
+                        }
+                        if (!added.empty() || get_last_facet(pivot.second) != cell)
+                        {
+                            // an added cell cancels out when it was added twice
+                            std::sort(added.begin(), added.end());
+                            vector<int64_t> kept = {cell};
+                            for (size_t k = 0; k < added.size(); k++)
+                            {
+                                if (k + 1 < added.size() && added[k] == added[k + 1])
+                                    k++;
+                                else
+                                    kept.push_back(added[k]);
+                            }
+                            kept_columns.emplace(pivot.second, std::move(kept));
+                        }
+                        break;
+                    }
+                    const auto kept = kept_columns.find(pivot.second);
+                    if (kept == kept_columns.end())
+                    {
+                        const int64_t facet = get_last_facet(pivot.second);
+                        add_cofaces(facet);
+                        added.push_back(facet);
+                    }
+                    else
+                    {
+                        for (int64_t other : kept->second)
+                        {
+                            add_cofaces(other);
+                            added.push_back(other);
+                        }
+                    }
+                }
+            }
+        }
+        // the pivots are the killing cells of dim + 1, which never create a class
+        cleared = std::move(pivots);
+    }
+
+    return result;
+}
+
+inline void export_cubical_ph(const vector<ph_pair> &pairs, const string &path)
+{
+    std::ofstream file(path, std::ios_base::out);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    file << "dimension,birth,death,x,y,z\n";
+    for (const ph_pair &pair : pairs)
+    {
+        // report the location of the creating cell in voxel units
+        file << pair.dimension << "," << pair.birth << "," << pair.death << ","
+             << pair.birth_simplex[0] / 2.0f << "," << pair.birth_simplex[1] / 2.0f << "," << pair.birth_simplex[2] / 2.0f << "\n";
+    }
+}
+
+// Image mode entry point, see main.cpp
+inline void run_cubical_ph(const json &config)
+{
+    const string image_file = config.at("imageFile").get<string>();
+    const string image_format = config.value("imageFormat", string("raw"));
+
+    log("Loading image.");
+    const cubical_image image = image_format == "mrc"
+                                    ? load_mrc_image(image_file)
+                                    : load_raw_image(image_file,
+                                                     config.at("imageShape").get<vector<int64_t>>(),
+                                                     config.value("imageType", string("uint8")));
+    log("  ", image.shape[0], " x ", image.shape[1], " x ", image.shape[2], " voxels");
+
+    const vector<ph_pair> pairs = compute_cubical_ph(image);
+
+    int counts[4] = {0, 0, 0, 0};
+    for (const ph_pair &pair : pairs)
+    {
+        counts[pair.dimension]++;
+    }
+    log("  ", counts[0], " H0, ", counts[1], " H1, ", counts[2], " H2 features");
+
+    export_cubical_ph(pairs, config.at("PHDiagram").get<string>());
+}
+
+#endif //ST_VISUALIZER_PHCUBICAL_H
@@ -6,6 +6,9 @@
 #define ST_VISUALIZER_PHEXPORT_H
 
 #include <Eigen/Eigen>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -15,9 +18,44 @@ using std::string;
 using std::stringstream;
 
 extern bool ph_toggle;
+extern bool ph_binary;
 extern string ph_points_path;
 extern string ph_tets_path;
 
+// number of values collected before each write of the binary export
+#define PH_BINARY_BLOCK_SIZE (1 << 20)
+
+// Binary export, little-endian with a 16 byte header so that the data can be mapped with numpy.memmap:
+//  char[4] magic ("STPP" for points, "STPT" for tets), uint32 version, uint32 rows, uint32 columns
+//  points: float32[rows][columns], each row is x, y, z followed by the material values
+//  tets:   int32[rows][4]
+template <typename T>
+void export_ph_binary(const string &path, const char (&magic)[5], size_t rows, size_t columns,
+                      const std::function<void(size_t, T *)> &get_row)
+{
+    std::ofstream file(path, std::ios_base::out | std::ios_base::binary);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    const uint32_t header[3] = {1, static_cast<uint32_t>(rows), static_cast<uint32_t>(columns)};
+    file.write(magic, 4);
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    const size_t rows_per_block = std::max<size_t>(1, PH_BINARY_BLOCK_SIZE / columns);
+    vector<T> block(rows_per_block * columns);
+    for (size_t start = 0; start < rows; start += rows_per_block)
+    {
+        const size_t count = std::min(rows_per_block, rows - start);
+        for (size_t i = 0; i < count; i++)
+        {
+            get_row(start + i, block.data() + i * columns);
+        }
+        file.write(reinterpret_cast<const char *>(block.data()), static_cast<std::streamsize>(count * columns * sizeof(T)));
+    }
+}
+
 inline void export_ph(const vector<Eigen::Vector3f> &points, const vector<vector<float>> &materials, const vector<vector<int>> &tets)
 {
     if (!ph_toggle)
@@ -25,6 +63,18 @@ inline void export_ph(const vector<Eigen::Vector3f> &points, const vector<vector
         return;
     }
 
+    if (ph_binary)
+    {
+        const size_t num_materials = materials.empty() ? 0 : materials[0].size();
+        export_ph_binary<float>(ph_points_path, "STPP", points.size(), 3 + num_materials, [&](size_t i, float *row)
+                                {
+            std::copy(points[i].data(), points[i].data() + 3, row);
+            std::copy(materials[i].begin(), materials[i].end(), row + 3); });
+        export_ph_binary<int32_t>(ph_tets_path, "STPT", tets.size(), 4, [&](size_t i, int32_t *row)
+                                  { std::copy(tets[i].begin(), tets[i].begin() + 4, row); });
+        return;
+    }
+
     std::ofstream file_points(ph_points_path, std::ios_base::out);
     std::ofstream file_tets(ph_tets_path, std::ios_base::out);
     if (file_points.is_open() && file_tets.is_open())
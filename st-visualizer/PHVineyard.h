@@ -0,0 +1,523 @@
+#ifndef ST_VISUALIZER_PHVINEYARD_H
+#define ST_VISUALIZER_PHVINEYARD_H
+
+#include "PHCompute.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <queue>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// transpositions per simplex beyond which a fresh reduction is cheaper than updating
+#define VINEYARD_TRANSPOSITION_LIMIT 16
+// bytes beyond which the cache is not written, as the reducing chains of large meshes can fill in badly
+#define VINEYARD_CACHE_LIMIT (1ll << 30)
+
+extern string ph_vineyard_path;
+
+// the simplices of a complex with their boundaries, in terms of simplex index
+struct ph_vineyard_complex
+{
+    // vertices first, then edges, triangles and tets, each sorted
+    vector<vector<int>> simplices;
+    vector<vector<int>> boundaries;
+};
+
+inline ph_vineyard_complex get_vineyard_complex(const ph_complex &complex, const vector<vector<int>> &tets, int num_points)
+{
+    ph_vineyard_complex result;
+    result.simplices.reserve(num_points + complex.edges.size() + complex.triangles.size() + tets.size());
+    for (int i = 0; i < num_points; i++)
+    {
+        result.simplices.push_back({i});
+    }
+    for (const auto *cells : {&complex.edges, &complex.triangles, &tets})
+    {
+        for (vector<int> simplex : *cells)
+        {
+            std::sort(simplex.begin(), simplex.end());
+            result.simplices.push_back(std::move(simplex));
+        }
+    }
+
+    unordered_map<vector<int>, int, SimplexHash, SimplexEqual> simplex_to_ind;
+    for (int i = 0; i < result.simplices.size(); i++)
+    {
+        simplex_to_ind[result.simplices[i]] = i;
+    }
+
+    result.boundaries.reserve(result.simplices.size());
+    for (vector<int> &simplex : result.simplices)
+    {
+        vector<phat::index> boundary_idx = get_boundary_idx(simplex, simplex_to_ind);
+        vector<int> boundary(boundary_idx.begin(), boundary_idx.end());
+        std::sort(boundary.begin(), boundary.end());
+        result.boundaries.push_back(std::move(boundary));
+    }
+
+    return result;
+}
+
+// Persistence of one material filtration, kept reduced (R = DV) while the filtration order changes, after
+// Cohen-Steiner, Edelsbrunner and Morozov, "Vines and Vineyards by Updating Persistence in Linear Time".
+// Rows and columns are simplex indices rather than positions, so swapping two neighbours in the filtration
+// only touches the position tables and the few columns whose lowest row is one of the two simplices.
+class ph_vineyard
+{
+    const ph_vineyard_complex &complex;
+
+    vector<float> values;  // filtration value by simplex
+    vector<int> order;     // simplex at each position
+    vector<int> position;  // position of each simplex
+    vector<vector<int>> r; // reduced boundary columns by simplex, sorted by simplex index
+    vector<vector<int>> v; // reducing chains by simplex, sorted by simplex index
+    vector<int> low;       // lowest row of each column of r, -1 if the column is zero
+    vector<int> low_owner; // column whose lowest row is the given simplex, -1 if none
+
+    static void add_column(vector<int> &target, const vector<int> &source)
+    {
+        vector<int> sum;
+        sum.reserve(target.size() + source.size());
+        std::set_symmetric_difference(target.begin(), target.end(), source.begin(), source.end(), std::back_inserter(sum));
+        target.swap(sum);
+    }
+
+    int get_low(const vector<int> &column) const
+    {
+        int result = -1;
+        for (int row : column)
+        {
+            if (result == -1 || position[row] > position[result])
+                result = row;
+        }
+        return result;
+    }
+
+    int get_dim(int simplex) const { return static_cast<int>(complex.simplices[simplex].size()) - 1; }
+
+    // filtration order: by value, faces before cofaces, ties by simplex index
+    bool comes_before(const vector<float> &simplex_values, int a, int b) const
+    {
+        return std::make_tuple(simplex_values[a], get_dim(a), a) < std::make_tuple(simplex_values[b], get_dim(b), b);
+    }
+
+    vector<float> get_values(const vector<float> &alphas) const
+    {
+        vector<float> result(complex.simplices.size());
+        for (int i = 0; i < complex.simplices.size(); i++)
+        {
+            result[i] = get_alpha(complex.simplices[i], alphas);
+        }
+        return result;
+    }
+
+    // reduce the given columns against the rest of r, earlier columns keep their lowest rows
+    void resolve(vector<int> columns)
+    {
+        auto later = [this](int a, int b) { return position[a] > position[b]; };
+        std::priority_queue<int, vector<int>, decltype(later)> pending(later, std::move(columns));
+        while (!pending.empty())
+        {
+            const int column = pending.top();
+            pending.pop();
+            while (low[column] != -1)
+            {
+                const int owner = low_owner[low[column]];
+                if (owner == -1 || owner == column)
+                {
+                    low_owner[low[column]] = column;
+                    break;
+                }
+                if (position[owner] < position[column])
+                {
+                    add_column(r[column], r[owner]);
+                    add_column(v[column], v[owner]);
+                    low[column] = get_low(r[column]);
+                }
+                else
+                {
+                    low_owner[low[column]] = column;
+                    pending.push(owner);
+                    break;
+                }
+            }
+        }
+    }
+
+public:
+    explicit ph_vineyard(const ph_vineyard_complex &complex) : complex(complex)
+    {
+    }
+
+    // reduce the filtration of the given point alphas from scratch, with clearing: the columns are reduced from the
+    // highest dimension down, and a column that is the lowest row of a reduced column is zeroed without being
+    // reduced, with that reduced column as its reducing chain
+    void reduce(const vector<float> &alphas)
+    {
+        const size_t num_simplices = complex.simplices.size();
+        values = get_values(alphas);
+        order.resize(num_simplices);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return comes_before(values, a, b); });
+        position.resize(num_simplices);
+        for (int i = 0; i < num_simplices; i++)
+        {
+            position[order[i]] = i;
+        }
+
+        r = complex.boundaries;
+        v.resize(num_simplices);
+        for (int i = 0; i < num_simplices; i++)
+        {
+            v[i] = {i};
+        }
+        low.assign(num_simplices, -1);
+        low_owner.assign(num_simplices, -1);
+        vector<bool> cleared(num_simplices, false);
+        for (int dim = 3; dim > 0; dim--)
+        {
+            for (int column : order)
+            {
+                if (get_dim(column) != dim || cleared[column])
+                    continue;
+                low[column] = get_low(r[column]);
+                resolve({column});
+                if (low[column] != -1)
+                {
+                    const int row = low[column];
+                    cleared[row] = true;
+                    r[row].clear();
+                    v[row] = r[column];
+                }
+            }
+        }
+    }
+
+    // swap the simplices at positions i and i + 1, the new order must still be a filtration
+    void transpose(int i)
+    {
+        const int sigma = order[i];
+        const int tau = order[i + 1];
+
+        vector<int> affected = {sigma, tau};
+        for (int row : {sigma, tau})
+        {
+            if (low_owner[row] != -1)
+                affected.push_back(low_owner[row]);
+        }
+
+        // keep v upper triangular once tau comes first
+        if (get_dim(sigma) == get_dim(tau) && std::binary_search(v[tau].begin(), v[tau].end(), sigma))
+        {
+            add_column(v[tau], v[sigma]);
+            add_column(r[tau], r[sigma]);
+        }
+
+        std::swap(order[i], order[i + 1]);
+        position[sigma] = i + 1;
+        position[tau] = i;
+
+        std::sort(affected.begin(), affected.end());
+        affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+        for (int column : affected)
+        {
+            if (low[column] != -1 && low_owner[low[column]] == column)
+                low_owner[low[column]] = -1;
+            low[column] = get_low(r[column]);
+        }
+        resolve(affected);
+    }
+
+    // move to the filtration of the given point alphas by transpositions
+    // returns the number of transpositions, or -1 if more than limit were needed and the filtration was reduced anew
+    long long update(const vector<float> &alphas, long long limit)
+    {
+        const vector<float> new_values = get_values(alphas);
+
+        // count the inversions between the current and the new order
+        vector<int> target(order.size());
+        {
+            vector<int> new_order = order;
+            std::sort(new_order.begin(), new_order.end(), [&](int a, int b) { return comes_before(new_values, a, b); });
+            vector<int> rank(order.size());
+            for (int j = 0; j < new_order.size(); j++)
+            {
+                rank[new_order[j]] = j;
+            }
+            for (int j = 0; j < order.size(); j++)
+            {
+                target[j] = rank[order[j]];
+            }
+        }
+        long long inversions = 0;
+        {
+            // merge sort count
+            vector<int> work = target;
+            vector<int> buffer(work.size());
+            for (size_t width = 1; width < work.size() && inversions <= limit; width *= 2)
+            {
+                for (size_t lo = 0; lo < work.size(); lo += 2 * width)
+                {
+                    const size_t mid = std::min(lo + width, work.size());
+                    const size_t hi = std::min(lo + 2 * width, work.size());
+                    size_t a = lo, b = mid, out = lo;
+                    while (a < mid && b < hi)
+                    {
+                        if (work[b] < work[a])
+                        {
+                            inversions += static_cast<long long>(mid - a);
+                            buffer[out++] = work[b++];
+                        }
+                        else
+                        {
+                            buffer[out++] = work[a++];
+                        }
+                    }
+                    std::copy(work.begin() + a, work.begin() + mid, buffer.begin() + out);
+                    std::copy(work.begin() + b, work.begin() + hi, buffer.begin() + out + (mid - a));
+                }
+                work.swap(buffer);
+            }
+        }
+
+        if (inversions > limit)
+        {
+            reduce(alphas);
+            return -1;
+        }
+
+        // insertion sort, every swap exchanges two simplices that are out of order
+        values = new_values;
+        for (int j = 1; j < target.size(); j++)
+        {
+            for (int k = j; k > 0 && target[k - 1] > target[k]; k--)
+            {
+                transpose(k - 1);
+                std::swap(target[k - 1], target[k]);
+            }
+        }
+        return inversions;
+    }
+
+    vector<ph_pair> get_pairs() const
+    {
+        vector<std::pair<int, int>> pairs;
+        for (int column = 0; column < low.size(); column++)
+        {
+            if (low[column] != -1)
+                pairs.emplace_back(position[low[column]], position[column]);
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        vector<ph_pair> result;
+        result.reserve(pairs.size());
+        for (const auto &[birth, death] : pairs)
+        {
+            const int birth_simplex = order[birth];
+            const int death_simplex = order[death];
+            result.push_back({get_dim(birth_simplex), values[birth_simplex], values[death_simplex],
+                              complex.simplices[birth_simplex], complex.simplices[death_simplex]});
+        }
+        return result;
+    }
+
+    void save(std::ofstream &file) const
+    {
+        auto write_vector = [&file](const auto &vec)
+        {
+            const int64_t size = vec.size();
+            file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+            file.write(reinterpret_cast<const char *>(vec.data()), static_cast<std::streamsize>(size * sizeof(vec[0])));
+        };
+        write_vector(values);
+        write_vector(order);
+        for (const vector<int> &column : v)
+        {
+            write_vector(column);
+        }
+    }
+
+    // bytes written by save
+    long long get_saved_size() const
+    {
+        long long size = static_cast<long long>((2 + v.size()) * sizeof(int64_t) + values.size() * sizeof(float) + order.size() * sizeof(int));
+        for (const vector<int> &column : v)
+        {
+            size += static_cast<long long>(column.size() * sizeof(int));
+        }
+        return size;
+    }
+
+    bool load(std::ifstream &file)
+    {
+        auto read_vector = [&file](auto &vec)
+        {
+            int64_t size = 0;
+            file.read(reinterpret_cast<char *>(&size), sizeof(size));
+            if (!file || size < 0)
+                return false;
+            vec.resize(size);
+            file.read(reinterpret_cast<char *>(vec.data()), static_cast<std::streamsize>(size * sizeof(vec[0])));
+            return static_cast<bool>(file);
+        };
+
+        const size_t num_simplices = complex.simplices.size();
+        if (!read_vector(values) || !read_vector(order) || values.size() != num_simplices || order.size() != num_simplices)
+            return false;
+
+        // order has to be a permutation of the simplices
+        position.assign(num_simplices, -1);
+        for (int i = 0; i < num_simplices; i++)
+        {
+            if (order[i] < 0 || order[i] >= num_simplices || position[order[i]] != -1)
+                return false;
+            position[order[i]] = i;
+        }
+
+        // the chains have to be sorted simplex indices, r follows as D v
+        v.resize(num_simplices);
+        r.resize(num_simplices);
+        vector<int> rows;
+        for (int column = 0; column < num_simplices; column++)
+        {
+            if (!read_vector(v[column]) || v[column].empty() || v[column].front() < 0 || v[column].back() >= num_simplices ||
+                std::adjacent_find(v[column].begin(), v[column].end(), std::greater_equal<int>()) != v[column].end())
+                return false;
+            rows.clear();
+            for (int simplex : v[column])
+            {
+                rows.insert(rows.end(), complex.boundaries[simplex].begin(), complex.boundaries[simplex].end());
+            }
+            std::sort(rows.begin(), rows.end());
+            r[column].clear();
+            for (size_t k = 0; k < rows.size(); k++)
+            {
+                if (k + 1 < rows.size() && rows[k] == rows[k + 1])
+                    k++;
+                else
+                    r[column].push_back(rows[k]);
+            }
+        }
+        low.assign(num_simplices, -1);
+        low_owner.assign(num_simplices, -1);
+        for (int column = 0; column < num_simplices; column++)
+        {
+            low[column] = get_low(r[column]);
+            if (low[column] != -1)
+                low_owner[low[column]] = column;
+        }
+        return true;
+    }
+};
+
+// Same as compute_ph, but the reduced filtration of every material is kept in the file at path. When the next run
+// has the same complex, e.g. after changing the feature selection or weights, each material is updated by
+// transpositions instead of being reduced from scratch. Only the filtration and the reducing chains v are kept, r is
+// rebuilt from them, and no cache is written if it would be over VINEYARD_CACHE_LIMIT bytes.
+inline vector<vector<ph_pair>> compute_ph_incremental(const vector<vector<float>> &materials, const materialArgmax &argmax, const vector<vector<int>> &tets, const string &path)
+{
+    const int32_t version = 2;
+    int num_materials = materials[0].size();
+    int num_points = materials.size();
+
+    const ph_vineyard_complex complex = get_vineyard_complex(get_ph_complex(tets), tets, num_points);
+    const long long limit = VINEYARD_TRANSPOSITION_LIMIT * static_cast<long long>(complex.simplices.size());
+    log("  ", complex.simplices.size(), " simplices in the filtration");
+
+    // the cache is only usable if it was written for the same complex
+    std::ifstream cache(path, std::ios::binary);
+    bool cached = cache.is_open();
+    if (cached)
+    {
+        int32_t cached_version = 0;
+        cache.read(reinterpret_cast<char *>(&cached_version), sizeof(cached_version));
+        int64_t cached_simplices = 0;
+        cache.read(reinterpret_cast<char *>(&cached_simplices), sizeof(cached_simplices));
+        cached = cache && cached_version == version && cached_simplices == complex.simplices.size();
+        vector<int> simplex;
+        for (int i = 0; cached && i < complex.simplices.size(); i++)
+        {
+            int32_t size = 0;
+            cache.read(reinterpret_cast<char *>(&size), sizeof(size));
+            simplex.resize(std::clamp(size, 0, 4));
+            cache.read(reinterpret_cast<char *>(simplex.data()), static_cast<std::streamsize>(simplex.size() * sizeof(int)));
+            cached = cache && simplex == complex.simplices[i];
+        }
+    }
+
+    const string temp_path = path + ".tmp";
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Unable to open file");
+    }
+    const int64_t num_simplices = complex.simplices.size();
+    file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    file.write(reinterpret_cast<const char *>(&num_simplices), sizeof(num_simplices));
+    for (const vector<int> &simplex : complex.simplices)
+    {
+        const int32_t size = simplex.size();
+        file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        file.write(reinterpret_cast<const char *>(simplex.data()), static_cast<std::streamsize>(size * sizeof(int)));
+    }
+
+    // compute persistent homology for each material except the last one (no tissue)
+    long long cache_size = 0;
+    vector<vector<ph_pair>> result;
+    for (int material_idx = 0; material_idx < num_materials - 1; material_idx++)
+    {
+        const vector<float> alphas = get_material_alphas(materials, argmax, material_idx);
+        ph_vineyard vineyard(complex);
+        cached = cached && vineyard.load(cache);
+        if (cached)
+        {
+            const long long transpositions = vineyard.update(alphas, limit);
+            if (transpositions < 0)
+                log("  material ", material_idx, ": order changed too much, reduced from scratch");
+            else
+                log("  material ", material_idx, ": updated with ", transpositions, " transpositions");
+        }
+        else
+        {
+            vineyard.reduce(alphas);
+        }
+        cache_size += vineyard.get_saved_size();
+        if (cache_size <= VINEYARD_CACHE_LIMIT)
+            vineyard.save(file);
+
+        vector<ph_pair> pairs = vineyard.get_pairs();
+        print_pairs(pairs);
+        result.push_back(std::move(pairs));
+    }
+
+    cache.close();
+    file.close();
+    // a failed write leaves the old cache, which is still a valid starting point
+    std::error_code error;
+    if (cache_size > VINEYARD_CACHE_LIMIT)
+    {
+        log("  cache of ", cache_size, " bytes is over the limit, not written");
+        std::filesystem::remove(temp_path, error);
+    }
+    else
+    {
+        if (file)
+            std::filesystem::rename(temp_path, path, error);
+        if (!file || error)
+        {
+            log("  unable to write the cache to ", path);
+            std::filesystem::remove(temp_path, error);
+        }
+    }
+
+    return result;
+}
+
+#endif //ST_VISUALIZER_PHVINEYARD_H
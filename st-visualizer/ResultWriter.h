@@ -0,0 +1,766 @@
+#ifndef ST_VISUALIZER_RESULTWRITER_H
+#define ST_VISUALIZER_RESULTWRITER_H
+
+#include "Contour3D.h"
+#include "JSONParser.h"
+#include "MeshOptimize.h"
+#include "UtilityFunctions.h"
+
+#include <Eigen/Eigen>
+
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using nlohmann::json;
+using std::pair;
+using std::string;
+using std::tuple;
+using std::vector;
+
+#define RESULT_WRITER_BUFFER_SIZE (1 << 20)
+#define RESULT_BLOB_ALIGNMENT 8
+
+// Streams JSON straight from the result buffers to a file, without building a json DOM first.
+// Numbers and strings are formatted exactly like nlohmann::json::dump(), so the output is unchanged.
+class JsonWriter
+{
+public:
+    explicit JsonWriter(const string &path) : buffer(RESULT_WRITER_BUFFER_SIZE)
+    {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("Unable to open file");
+        }
+    }
+
+    JsonWriter(const JsonWriter &) = delete;
+    JsonWriter &operator=(const JsonWriter &) = delete;
+
+    ~JsonWriter()
+    {
+        if (file != nullptr)
+        {
+            std::fwrite(buffer.data(), 1, pos, file);
+            std::fclose(file);
+        }
+    }
+
+    void beginObject()
+    {
+        separate();
+        put('{');
+        first.push_back(true);
+    }
+
+    void endObject()
+    {
+        first.pop_back();
+        put('}');
+    }
+
+    void beginArray()
+    {
+        separate();
+        put('[');
+        first.push_back(true);
+    }
+
+    void endArray()
+    {
+        first.pop_back();
+        put(']');
+    }
+
+    void key(const string &name)
+    {
+        separate();
+        writeString(name);
+        put(':');
+        afterKey = true;
+    }
+
+    template <typename T>
+    void field(const string &name, const T &value)
+    {
+        key(name);
+        write(value);
+    }
+
+    void write(const string &value)
+    {
+        separate();
+        writeString(value);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type write(T value)
+    {
+        separate();
+        reserve(32);
+        if constexpr (std::is_same<T, bool>::value)
+        {
+            append(value ? "true" : "false");
+        }
+        else if constexpr (std::is_floating_point<T>::value)
+        {
+            pos = formatFloat(buffer.data() + pos, static_cast<double>(value)) - buffer.data();
+        }
+        else
+        {
+            pos = std::to_chars(buffer.data() + pos, buffer.data() + buffer.size(), value).ptr - buffer.data();
+        }
+    }
+
+    template <typename T>
+    void write(const vector<T> &values)
+    {
+        beginArray();
+        for (const T &value : values)
+        {
+            write(value);
+        }
+        endArray();
+    }
+
+    template <typename A, typename B>
+    void write(const pair<A, B> &value)
+    {
+        beginArray();
+        write(value.first);
+        write(value.second);
+        endArray();
+    }
+
+    template <typename... T>
+    void write(const std::tuple<T...> &value)
+    {
+        beginArray();
+        std::apply([this](const auto &...elems)
+                   { (write(elems), ...); },
+                   value);
+        endArray();
+    }
+
+    void write(const Eigen::Vector3f &value)
+    {
+        beginArray();
+        write(value[0]);
+        write(value[1]);
+        write(value[2]);
+        endArray();
+    }
+
+    // one [x, y, z] array per column
+    void write(const Eigen::Matrix3Xf &value)
+    {
+        beginArray();
+        for (Eigen::Index i = 0; i < value.cols(); i++)
+        {
+            write(Eigen::Vector3f(value.col(i)));
+        }
+        endArray();
+    }
+
+    void close()
+    {
+        flush();
+        std::fclose(file);
+        file = nullptr;
+    }
+
+private:
+    std::FILE *file;
+    vector<char> buffer;
+    size_t pos = 0;
+    vector<bool> first;
+    bool afterKey = false;
+
+    void flush()
+    {
+        if (pos > 0 && std::fwrite(buffer.data(), 1, pos, file) != pos)
+        {
+            throw std::runtime_error("Unable to write file");
+        }
+        pos = 0;
+    }
+
+    void reserve(size_t count)
+    {
+        if (pos + count > buffer.size())
+        {
+            flush();
+        }
+    }
+
+    void put(char c)
+    {
+        reserve(1);
+        buffer[pos++] = c;
+    }
+
+    void append(const char *text)
+    {
+        const size_t len = std::strlen(text);
+        reserve(len);
+        std::memcpy(buffer.data() + pos, text, len);
+        pos += len;
+    }
+
+    // comma before every element but the first of its array or object
+    void separate()
+    {
+        if (afterKey)
+        {
+            afterKey = false;
+            return;
+        }
+        if (!first.empty())
+        {
+            if (!first.back())
+            {
+                put(',');
+            }
+            first.back() = false;
+        }
+    }
+
+    void writeString(const string &value)
+    {
+        static const char *hex = "0123456789abcdef";
+        put('"');
+        for (const char c : value)
+        {
+            switch (c)
+            {
+            case '"':
+                append("\\\"");
+                break;
+            case '\\':
+                append("\\\\");
+                break;
+            case '\b':
+                append("\\b");
+                break;
+            case '\f':
+                append("\\f");
+                break;
+            case '\n':
+                append("\\n");
+                break;
+            case '\r':
+                append("\\r");
+                break;
+            case '\t':
+                append("\\t");
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    const char escaped[] = {'\\', 'u', '0', '0', hex[(c >> 4) & 0xF], hex[c & 0xF], '\0'};
+                    append(escaped);
+                }
+                else
+                {
+                    put(c);
+                }
+            }
+        }
+        put('"');
+    }
+
+    // Shortest round trip digits from std::to_chars, laid out like nlohmann's dtoa:
+    // fixed notation for decimal exponents in (-4, 15], otherwise d.igitse+XX, and always a '.' or 'e'
+    static char *formatFloat(char *out, double value)
+    {
+        if (!std::isfinite(value))
+        {
+            std::memcpy(out, "null", 4);
+            return out + 4;
+        }
+        if (std::signbit(value))
+        {
+            *out++ = '-';
+            value = -value;
+        }
+        if (value == 0)
+        {
+            std::memcpy(out, "0.0", 3);
+            return out + 3;
+        }
+
+        char sci[32];
+        const char *end = std::to_chars(sci, sci + sizeof(sci), value, std::chars_format::scientific).ptr;
+        char digits[20];
+        int k = 0;
+        const char *c = sci;
+        for (; *c != 'e'; c++)
+        {
+            if (*c != '.')
+                digits[k++] = *c;
+        }
+        c++;
+        if (*c == '+')
+            c++;
+        int exponent = 0;
+        std::from_chars(c, end, exponent);
+
+        // value = 0.digits * 10^n
+        const int n = exponent + 1;
+        constexpr int minExp = -4;
+        constexpr int maxExp = std::numeric_limits<double>::digits10;
+        if (k <= n && n <= maxExp)
+        {
+            std::memcpy(out, digits, k);
+            std::memset(out + k, '0', n - k);
+            out[n] = '.';
+            out[n + 1] = '0';
+            return out + n + 2;
+        }
+        if (0 < n && n <= maxExp)
+        {
+            std::memcpy(out, digits, n);
+            out[n] = '.';
+            std::memcpy(out + n + 1, digits + n, k - n);
+            return out + k + 1;
+        }
+        if (minExp < n && n <= 0)
+        {
+            out[0] = '0';
+            out[1] = '.';
+            std::memset(out + 2, '0', -n);
+            std::memcpy(out + 2 - n, digits, k);
+            return out + 2 - n + k;
+        }
+
+        *out++ = digits[0];
+        if (k > 1)
+        {
+            *out++ = '.';
+            std::memcpy(out, digits + 1, k - 1);
+            out += k - 1;
+        }
+        *out++ = 'e';
+        int e = n - 1;
+        *out++ = e < 0 ? '-' : '+';
+        e = std::abs(e);
+        if (e < 10)
+            *out++ = '0';
+        return std::to_chars(out, out + 4, e).ptr;
+    }
+};
+
+template <typename T>
+constexpr const char *typedArrayName();
+template <>
+constexpr const char *typedArrayName<float>() { return "float32"; }
+template <>
+constexpr const char *typedArrayName<uint32_t>() { return "uint32"; }
+template <>
+constexpr const char *typedArrayName<uint16_t>() { return "uint16"; }
+template <>
+constexpr const char *typedArrayName<uint8_t>() { return "uint8"; }
+
+// Binary result blob: little-endian typed arrays, each starting on an 8 byte boundary so the frontend can view
+// it directly as a Float32Array / Uint32Array / Uint8Array. add() returns the descriptor the manifest stores.
+class BlobWriter
+{
+public:
+    // compact: quantize mesh vertices and varint code mesh indices, see addVertexBuffer / addIndexBuffer
+    explicit BlobWriter(const string &path, bool compact = false) : compact(compact), file(path, std::ios::binary)
+    {
+        static_assert(std::endian::native == std::endian::little, "the result blob is written in host byte order");
+        if (!file.is_open())
+        {
+            throw std::runtime_error("Unable to open file");
+        }
+    }
+
+    template <typename T>
+    json add(const vector<T> &data)
+    {
+        static const char zeros[RESULT_BLOB_ALIGNMENT] = {};
+        const size_t padding = (RESULT_BLOB_ALIGNMENT - size % RESULT_BLOB_ALIGNMENT) % RESULT_BLOB_ALIGNMENT;
+        file.write(zeros, static_cast<std::streamsize>(padding));
+        size += padding;
+
+        json descriptor = {{"type", typedArrayName<T>()}, {"byteOffset", size}, {"length", data.size()}};
+        file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size() * sizeof(T)));
+        size += data.size() * sizeof(T);
+        return descriptor;
+    }
+
+    const bool compact;
+
+private:
+    std::ofstream file;
+    size_t size = 0;
+};
+
+inline void appendVertices(vector<float> &out, const vector<Eigen::Vector3f> &vertices)
+{
+    for (const Eigen::Vector3f &v : vertices)
+    {
+        out.insert(out.end(), v.data(), v.data() + 3);
+    }
+}
+
+// Vertex triples of a set of meshes, mesh i owns vertices [vertexOffsets[i], vertexOffsets[i + 1]).
+// Compact blobs quantize each mesh to uint16 against its own bounding box, listed as min xyz, max xyz:
+// v = min + q / 65535 * (max - min)
+inline json addVertexBuffer(BlobWriter &blob, const vector<float> &vertices, const vector<uint32_t> &vertexOffsets)
+{
+    if (!blob.compact)
+    {
+        return blob.add(vertices);
+    }
+
+    vector<uint16_t> quantized(vertices.size());
+    vector<float> boxes;
+    boxes.reserve(6 * (vertexOffsets.size() - 1));
+    for (size_t mesh = 0; mesh + 1 < vertexOffsets.size(); mesh++)
+    {
+        Eigen::Array3f lo = Eigen::Array3f::Zero();
+        Eigen::Array3f hi = Eigen::Array3f::Zero();
+        for (uint32_t v = vertexOffsets[mesh]; v < vertexOffsets[mesh + 1]; v++)
+        {
+            const Eigen::Array3f p = Eigen::Map<const Eigen::Array3f>(vertices.data() + 3 * v);
+            lo = v == vertexOffsets[mesh] ? p : lo.min(p);
+            hi = v == vertexOffsets[mesh] ? p : hi.max(p);
+        }
+        const Eigen::Array3f extent = hi - lo;
+        for (uint32_t v = vertexOffsets[mesh]; v < vertexOffsets[mesh + 1]; v++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                const float t = extent[a] > 0 ? (vertices[3 * v + a] - lo[a]) / extent[a] : 0.0f;
+                quantized[3 * v + a] = static_cast<uint16_t>(std::lround(t * 65535.0f));
+            }
+        }
+        boxes.insert(boxes.end(), lo.data(), lo.data() + 3);
+        boxes.insert(boxes.end(), hi.data(), hi.data() + 3);
+    }
+
+    json descriptor = blob.add(quantized);
+    descriptor["encoding"] = "quantized";
+    descriptor["boxes"] = blob.add(boxes);
+    return descriptor;
+}
+
+// Mesh indices. Compact blobs store the zigzag coded difference to the previous index as a LEB128 varint,
+// length is then the size in bytes and count the number of indices.
+inline json addIndexBuffer(BlobWriter &blob, const vector<uint32_t> &indices)
+{
+    if (!blob.compact)
+    {
+        return blob.add(indices);
+    }
+
+    vector<uint8_t> bytes;
+    bytes.reserve(indices.size() * 2);
+    int64_t previous = 0;
+    for (const uint32_t index : indices)
+    {
+        const int64_t delta = static_cast<int64_t>(index) - previous;
+        previous = index;
+        uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+        while (zigzag >= 0x80)
+        {
+            bytes.push_back(static_cast<uint8_t>(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(zigzag));
+    }
+
+    json descriptor = blob.add(bytes);
+    descriptor["encoding"] = "delta-varint";
+    descriptor["count"] = indices.size();
+    return descriptor;
+}
+
+// uint8 ids unless there are more than 256 materials
+inline json addMaterialIds(BlobWriter &blob, const vector<int> &ids, size_t numMaterials)
+{
+    if (numMaterials <= 256)
+    {
+        return blob.add(vector<uint8_t>(ids.begin(), ids.end()));
+    }
+    return blob.add(vector<uint16_t>(ids.begin(), ids.end()));
+}
+
+// Point positions of all slices as xyz triples, slice i owns points [sliceOffsets[i], sliceOffsets[i + 1])
+inline json addPoints(BlobWriter &blob, const vector<Eigen::Matrix3Xf> &slices)
+{
+    vector<float> points;
+    vector<uint32_t> offsets = {0};
+    for (const Eigen::Matrix3Xf &slice : slices)
+    {
+        points.insert(points.end(), slice.data(), slice.data() + slice.size());
+        offsets.push_back(offsets.back() + static_cast<uint32_t>(slice.cols()));
+    }
+    return {{"points", blob.add(points)}, {"sliceOffsets", blob.add(offsets)}};
+}
+
+// Per point rows of a values / clusters table, row major in point order
+inline json addPointValues(BlobWriter &blob, const vector<vector<vector<float>>> &values)
+{
+    vector<float> flat;
+    for (const auto &slice : values)
+    {
+        for (const auto &row : slice)
+        {
+            flat.insert(flat.end(), row.begin(), row.end());
+        }
+    }
+    return {{"values", blob.add(flat)}, {"columns", values[0][0].size()}};
+}
+
+inline json addPointMaterials(BlobWriter &blob, const vector<vector<int>> &index, size_t numMaterials)
+{
+    vector<int> flat;
+    for (const auto &slice : index)
+    {
+        flat.insert(flat.end(), slice.begin(), slice.end());
+    }
+    return addMaterialIds(blob, flat, numMaterials);
+}
+
+// Contour curves of every slice and material, group g = slice * materials + material.
+// Segment indices are local to their group, like in the json output.
+inline json addContours2D(BlobWriter &blob,
+                          const vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>> &contours)
+{
+    vector<float> vertices;
+    vector<uint32_t> segments;
+    vector<uint32_t> vertexOffsets = {0};
+    vector<uint32_t> segmentOffsets = {0};
+    for (const auto &slice : contours)
+    {
+        for (const auto &[verts, segs] : slice)
+        {
+            appendVertices(vertices, verts);
+            for (const auto &[a, b] : segs)
+            {
+                segments.push_back(a);
+                segments.push_back(b);
+            }
+            vertexOffsets.push_back(static_cast<uint32_t>(vertices.size() / 3));
+            segmentOffsets.push_back(static_cast<uint32_t>(segments.size() / 2));
+        }
+    }
+    return {{"materials", contours.empty() ? 0 : contours[0].size()},
+            {"vertices", addVertexBuffer(blob, vertices, vertexOffsets)},
+            {"segments", addIndexBuffer(blob, segments)},
+            {"vertexOffsets", blob.add(vertexOffsets)},
+            {"segmentOffsets", blob.add(segmentOffsets)}};
+}
+
+// Filled regions of every slice, one material id per triangle, indices local to their slice
+inline json addTriangles2D(BlobWriter &blob,
+                           const vector<tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<int>>> &fills,
+                           size_t numMaterials)
+{
+    vector<float> vertices;
+    vector<uint32_t> triangles;
+    vector<int> materials;
+    vector<uint32_t> vertexOffsets = {0};
+    vector<uint32_t> triangleOffsets = {0};
+    for (const auto &[verts, tris, mats] : fills)
+    {
+        appendVertices(vertices, verts);
+        for (const auto &tri : tris)
+        {
+            triangles.insert(triangles.end(), tri.begin(), tri.end());
+        }
+        materials.insert(materials.end(), mats.begin(), mats.end());
+        vertexOffsets.push_back(static_cast<uint32_t>(vertices.size() / 3));
+        triangleOffsets.push_back(static_cast<uint32_t>(triangles.size() / 3));
+    }
+    return {{"vertices", addVertexBuffer(blob, vertices, vertexOffsets)},
+            {"triangles", addIndexBuffer(blob, triangles)},
+            {"materials", addMaterialIds(blob, materials, numMaterials)},
+            {"vertexOffsets", blob.add(vertexOffsets)},
+            {"triangleOffsets", blob.add(triangleOffsets)}};
+}
+
+// Surfaces per material. Faces are polygons: face f uses indices [faceIndexOffsets[f], faceIndexOffsets[f + 1]),
+// material m owns faces [faceOffsets[m], faceOffsets[m + 1]) and its indices are local to its own vertices.
+// With render meshes the faces are triangles, so indices is a plain triangle list, and normals holds a unit
+// normal per vertex.
+inline json addContours3D(BlobWriter &blob, const vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> &surfaces,
+                          const vector<renderMesh> *render = nullptr)
+{
+    vector<float> vertices;
+    vector<uint32_t> indices;
+    vector<uint32_t> faceIndexOffsets = {0};
+    vector<uint32_t> vertexOffsets = {0};
+    vector<uint32_t> faceOffsets = {0};
+    for (const auto &[verts, faces] : surfaces)
+    {
+        appendVertices(vertices, verts);
+        for (const auto &face : faces)
+        {
+            indices.insert(indices.end(), face.begin(), face.end());
+            faceIndexOffsets.push_back(static_cast<uint32_t>(indices.size()));
+        }
+        vertexOffsets.push_back(static_cast<uint32_t>(vertices.size() / 3));
+        faceOffsets.push_back(static_cast<uint32_t>(faceIndexOffsets.size() - 1));
+    }
+    json descriptor = {{"vertices", addVertexBuffer(blob, vertices, vertexOffsets)},
+                       {"indices", addIndexBuffer(blob, indices)},
+                       {"faceIndexOffsets", blob.add(faceIndexOffsets)},
+                       {"vertexOffsets", blob.add(vertexOffsets)},
+                       {"faceOffsets", blob.add(faceOffsets)}};
+    if (render)
+    {
+        vector<float> normals;
+        normals.reserve(vertices.size());
+        for (const renderMesh &mesh : *render)
+        {
+            appendVertices(normals, mesh.normals);
+        }
+        descriptor["normals"] = blob.add(normals);
+    }
+    return descriptor;
+}
+
+// Meshlets of every material: (triangleOffset, triangleCount) pairs into the material's faces, the boxes as
+// min xyz, max xyz, and the first meshlet of each material
+inline json addMeshlets(BlobWriter &blob, const vector<vector<meshlet>> &meshlets)
+{
+    vector<uint32_t> triangles;
+    vector<float> boxes;
+    vector<uint32_t> meshletOffsets = {0};
+    for (const auto &material : meshlets)
+    {
+        for (const meshlet &m : material)
+        {
+            triangles.push_back(m.triangleOffset);
+            triangles.push_back(m.triangleCount);
+            boxes.insert(boxes.end(), {m.min(0), m.min(1), m.min(2), m.max(0), m.max(1), m.max(2)});
+        }
+        meshletOffsets.push_back(static_cast<uint32_t>(triangles.size() / 2));
+    }
+    return {{"triangles", blob.add(triangles)},
+            {"boxes", blob.add(boxes)},
+            {"meshletOffsets", blob.add(meshletOffsets)}};
+}
+
+// Chunked layout: <target>.chunks/slice_<i>.json holds the points and 2D contours of slice i, and
+// values_<m>.json / clusters_<m>.json the 3D surface of one material. The index file at <target> lists them.
+inline std::filesystem::path getChunkDir(const string &target)
+{
+    return std::filesystem::path(target + ".chunks");
+}
+
+inline string getChunkName(const string &target, const string &name)
+{
+    return (getChunkDir(target).filename() / name).generic_string();
+}
+
+inline vector<string> getSliceChunkNames(const string &target, size_t numSlices)
+{
+    vector<string> names;
+    for (size_t i = 0; i < numSlices; i++)
+    {
+        names.push_back(getChunkName(target, "slice_" + std::to_string(i) + ".json"));
+    }
+    return names;
+}
+
+inline vector<string> getMaterialChunkNames(const string &target, const string &prefix, size_t numMaterials)
+{
+    vector<string> names;
+    for (size_t i = 0; i < numMaterials; i++)
+    {
+        names.push_back(getChunkName(target, prefix + "_" + std::to_string(i) + ".json"));
+    }
+    return names;
+}
+
+// one chunk per slice, written in parallel
+inline void writeSliceChunks(const string &target,
+                             const vector<Eigen::Matrix3Xf> &slices,
+                             const vector<vector<vector<float>>> &values,
+                             const vector<vector<vector<float>>> &clusters,
+                             const vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>> &ctrsVals,
+                             const vector<tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<int>>> &trisVals,
+                             const vector<vector<pair<vector<Eigen::Vector3f>, vector<pair<int, int>>>>> &ctrsClusters,
+                             const vector<tuple<vector<Eigen::Vector3f>, vector<vector<int>>, vector<int>>> &trisClusters)
+{
+    std::filesystem::create_directories(getChunkDir(target));
+    const std::filesystem::path dir = getChunkDir(target).parent_path();
+    const vector<string> names = getSliceChunkNames(target, slices.size());
+    parallelFor(slices.size(), [&](size_t i)
+                {
+        JsonWriter f((dir / names[i]).string());
+        f.beginObject();
+        f.field("clusters", clusters[i]);
+        f.field("ctrs2Dclusters", ctrsClusters[i]);
+        f.field("ctrs2Dvals", ctrsVals[i]);
+        f.field("slice", slices[i]);
+        f.field("tris2Dclusters", trisClusters[i]);
+        f.field("tris2Dvals", trisVals[i]);
+        f.field("values", values[i]);
+        f.endObject();
+        f.close(); });
+}
+
+// one chunk per material holding its [vertices, faces], written in parallel. With render buffers or meshlets the
+// chunk is an object holding them as "indices", "normals" and "meshlets" next to the [vertices, faces] in "surface",
+// with the same layout as the per material entries of the single file output.
+inline void writeMaterialChunks(const string &target, const string &prefix,
+                                const vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> &surfaces,
+                                const vector<renderMesh> *render = nullptr,
+                                const vector<vector<meshlet>> *meshlets = nullptr)
+{
+    std::filesystem::create_directories(getChunkDir(target));
+    const std::filesystem::path dir = getChunkDir(target).parent_path();
+    const vector<string> names = getMaterialChunkNames(target, prefix, surfaces.size());
+    parallelFor(surfaces.size(), [&](size_t i)
+                {
+        JsonWriter f((dir / names[i]).string());
+        if (!render && !meshlets)
+        {
+            f.write(surfaces[i]);
+            f.close();
+            return;
+        }
+        f.beginObject();
+        if (render)
+        {
+            f.field("indices", (*render)[i].indices);
+        }
+        if (meshlets)
+        {
+            f.key("meshlets");
+            f.beginArray();
+            for (const meshlet &m : (*meshlets)[i])
+            {
+                f.write(std::make_tuple(m.triangleOffset, m.triangleCount, m.min, m.max));
+            }
+            f.endArray();
+        }
+        if (render)
+        {
+            f.field("normals", (*render)[i].normals);
+        }
+        f.field("surface", surfaces[i]);
+        f.endObject();
+        f.close(); });
+}
+
+#endif //ST_VISUALIZER_RESULTWRITER_H
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Eigen/Eigen>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Uniform bucket grid over a set of 2D points for nearest neighbor queries. The cells hold about one point
+// each, so a query only looks at a few cells around the query point when the points are evenly spread.
+class spatialGrid
+{
+public:
+	explicit spatialGrid(const Eigen::Matrix2Xf &pts) : pts(pts)
+	{
+		const long long n = pts.cols();
+		if (n == 0)
+		{
+			return;
+		}
+		lo = pts.rowwise().minCoeff();
+		const Eigen::Vector2f extent = (pts.rowwise().maxCoeff() - lo).cwiseMax(std::numeric_limits<float>::epsilon());
+		// at most 4096 cells per side, e.g. when all points are on a line
+		cell = std::max(std::sqrt(extent(0) * extent(1) / static_cast<float>(n)), extent.maxCoeff() / 4096);
+		nx = std::clamp(static_cast<int>(extent(0) / cell) + 1, 1, 1 << 12);
+		ny = std::clamp(static_cast<int>(extent(1) / cell) + 1, 1, 1 << 12);
+
+		// points sorted by cell, in compressed rows
+		cell_start.assign(static_cast<size_t>(nx) * ny + 1, 0);
+		std::vector<int> cell_of(n);
+		for (long long i = 0; i < n; i++)
+		{
+			cell_of[i] = getCell(pts.col(i));
+			cell_start[cell_of[i] + 1]++;
+		}
+		for (size_t c = 1; c < cell_start.size(); c++)
+		{
+			cell_start[c] += cell_start[c - 1];
+		}
+		cell_points.resize(n);
+		std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+		for (long long i = 0; i < n; i++)
+		{
+			cell_points[fill[cell_of[i]]++] = static_cast<int>(i);
+		}
+	}
+
+	// Index of the point closest to q, skipping the point at index exclude. Equally close points resolve
+	// to the lowest index. Returns -1 if there is no other point.
+	int nearest(const Eigen::Vector2f &q, int exclude = -1) const
+	{
+		if (cell_points.empty())
+		{
+			return -1;
+		}
+		const int cx = std::clamp(static_cast<int>(std::floor((q(0) - lo(0)) / cell)), 0, nx - 1);
+		const int cy = std::clamp(static_cast<int>(std::floor((q(1) - lo(1)) / cell)), 0, ny - 1);
+
+		int best = -1;
+		float best_dist = std::numeric_limits<float>::max();
+		auto visit = [&](int x, int y)
+		{
+			const int c = y * nx + x;
+			for (int k = cell_start[c]; k < cell_start[c + 1]; k++)
+			{
+				const int i = cell_points[k];
+				if (i == exclude)
+					continue;
+				const float dist = (pts.col(i) - q).squaredNorm();
+				if (dist < best_dist || (dist == best_dist && i < best))
+				{
+					best_dist = dist;
+					best = i;
+				}
+			}
+		};
+
+		// rings of cells around the query cell, anything beyond ring r is at least r cells away
+		const int max_ring = std::max(nx, ny);
+		for (int r = 0; r <= max_ring; r++)
+		{
+			for (int x = cx - r; x <= cx + r; x++)
+			{
+				if (x < 0 || x >= nx)
+					continue;
+				if (cy - r >= 0)
+					visit(x, cy - r);
+				if (r > 0 && cy + r < ny)
+					visit(x, cy + r);
+			}
+			for (int y = cy - r + 1; y <= cy + r - 1; y++)
+			{
+				if (y < 0 || y >= ny)
+					continue;
+				if (cx - r >= 0)
+					visit(cx - r, y);
+				if (cx + r < nx)
+					visit(cx + r, y);
+			}
+			if (best != -1 && best_dist < (r * cell) * (r * cell))
+				break;
+		}
+		return best;
+	}
+
+	const Eigen::Matrix2Xf &points() const
+	{
+		return pts;
+	}
+
+private:
+	int getCell(const Eigen::Vector2f &p) const
+	{
+		const int x = std::clamp(static_cast<int>((p(0) - lo(0)) / cell), 0, nx - 1);
+		const int y = std::clamp(static_cast<int>((p(1) - lo(1)) / cell), 0, ny - 1);
+		return y * nx + x;
+	}
+
+	Eigen::Matrix2Xf pts;
+	Eigen::Vector2f lo = Eigen::Vector2f::Zero();
+	float cell = 1;
+	int nx = 1;
+	int ny = 1;
+	std::vector<int> cell_start;
+	std::vector<int> cell_points;
+};
@@ -6,6 +6,7 @@
 #include "Timing.h"
 #include "PHExport.h"
 #include "PHCompute.h"
+#include "PHVineyard.h"
 
 #include <algorithm>
 #include <queue>
@@ -286,7 +287,8 @@ vector<vector<int>> countAllComponents(vector<std::pair<std::vector<Eigen::Vecto
 }
 
 vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>>
-getVolumeContours(const Eigen::Matrix3Xf &pts, vector<vector<float>> vals, float shrink, bool material)
+getVolumeContours(const Eigen::Matrix3Xf &pts, vector<vector<float>> vals, materialArgmax argmax, float shrink, bool material,
+                  vector<renderMesh> *render = nullptr)
 {
 	const size_t nmat = vals[0].size();
     std::chrono::steady_clock::time_point start_contour_tetgen = std::chrono::high_resolution_clock::now();
@@ -302,12 +304,30 @@ getVolumeContours(const Eigen::Matrix3Xf &pts, vector<vector<float>> vals, float
 	{
 		pts_vector.emplace_back(pt);
 	}
-	auto [verts, segs, segmats] = contourTetMultiDC(pts_vector, tets, vals);
+
+	// the pairs of the simplified materials, reported below
+	vector<vector<ph_pair>> pairs;
+	if (material && ph_simplify)
+	{
+		log("Simplifying materials.");
+		const int cancelled = simplify_materials(vals, get_ph_complex(tets), tets, ph_threshold, pairs);
+		log("  ", cancelled, " features cancelled");
+		argmax = getMaterialArgmax(vals);
+	}
+
+	auto [verts, segs, segmats] = contourTetMultiDC(pts_vector, tets, vals, argmax.primary);
 
     if (material)
     {
         export_ph(pts_vector, vals, tets);
-        compute_ph(vals, tets);
+        if (ph_vineyard_path.empty())
+        {
+            compute_ph(vals, argmax, tets, pairs.empty() ? nullptr : &pairs);
+        }
+        else
+        {
+            compute_ph_incremental(vals, argmax, tets, ph_vineyard_path);
+        }
     }
 
 	vector<vector<int>> new_segs;
@@ -324,7 +344,7 @@ getVolumeContours(const Eigen::Matrix3Xf &pts, vector<vector<float>> vals, float
 		}
 	}
 
-	return getContourAllMats3D(verts, new_segs, new_segmats, nmat, shrink);
+	return getContourAllMats3D(verts, new_segs, new_segmats, nmat, shrink, render);
 }
 
 Eigen::Matrix3Xf concatMatrixes(const vector<Eigen::Matrix3Xf> &input)
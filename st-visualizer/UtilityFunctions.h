@@ -13,6 +13,10 @@
 #include <vector>
 #include <utility>
 #include <unordered_map>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 using std::vector;
 using std::string;
@@ -134,6 +138,55 @@ std::vector<G> mapVector(const std::vector<T> &vec, const std::function<G(const
     return mapVector(vec, new_op);
 }
 
+// Runs op for every index in [0, count) on all hardware threads. op must be safe to call concurrently.
+// The first exception thrown by op is rethrown once all threads have finished.
+inline void parallelFor(size_t count, const std::function<void(size_t)> &op)
+{
+    const size_t num_threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next = 0;
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (size_t t = 0; t < num_threads; t++)
+    {
+        threads.emplace_back([&]()
+                             {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                try
+                {
+                    op(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error)
+                        error = std::current_exception();
+                    next = count;
+                }
+            } });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Same as mapVector, but the items are mapped in parallel
+template <typename T, typename G>
+std::vector<G> mapVectorParallel(const std::vector<T> &vec, const std::function<G(const T &, size_t)> &op)
+{
+    std::vector<G> c(vec.size());
+    parallelFor(vec.size(), [&](size_t i)
+                { c[i] = op(vec[i], i); });
+    return c;
+}
+
 // mapThread and its overloads
 template <typename A, typename B, typename C>
 std::vector<C> mapThread(const std::vector<A> &vec1, const std::vector<B> &vec2,
@@ -420,72 +473,4 @@ std::vector<T> flatten(const std::vector<std::vector<T>> &input)
         }
     }
     return result;
-}
-
-inline int exportObj(string path, vector<pair<vector<Eigen::Vector3f>, vector<vector<int>>>> data, vector<string> names)
-{
-    const int nums = data.size();
-
-    for (int i = 0; i < nums; i++)
-    {
-        if (!std::filesystem::exists(path))
-        {
-            std::filesystem::create_directories(path);
-        }
-        std::ofstream target(path + names.at(i) + ".obj", std::ofstream::trunc);
-
-        // export the points
-        vector<Eigen::Vector3f> &vertices = data.at(i).first;
-        Hash_Edge_to_Face hash;
-        for (Eigen::Vector3f vertex : vertices)
-        {
-            std::stringstream ss;
-            ss.setf(std::ios::fixed);
-            ss.precision(16);
-            ss << "v ";
-            ss << vertex(0) << " ";
-            ss << vertex(1) << " ";
-            ss << vertex(2) << "\n";
-            target << ss.rdbuf();
-        }
-
-        // export the faces
-        vector<vector<int>> &faces = data.at(i).second;
-        for (int j = 0; j < faces.size(); j++)
-        {
-            vector<int> &face = faces.at(j);
-            std::stringstream ss;
-            ss << "f ";
-            for (int k = 0;k < face.size(); k++)
-            {
-                pair<int, int> edge;
-                if (k == face.size() - 1)
-                {
-                    edge = {face.at(k), face.at(0)};
-                }
-                else
-                {
-                    edge = {face.at(k), face.at(k+1)};
-                }
-
-                int &target = edge.first < edge.second ? hash.at(edge.first, edge.second).first : hash.at(edge.first, edge.second).second;
-
-                if (target != -1)
-                {
-                    log("Orientation error detected!");
-                }
-                else
-                {
-                    target = j;
-                }
-                ss << face.at(k) + 1 << " ";
-            }
-            ss << "\n";
-            target << ss.rdbuf();
-        }
-
-        target.close();
-    }
-
-    return 0;
 }
\ No newline at end of file
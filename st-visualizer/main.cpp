@@ -6,9 +6,18 @@
 #include "UtilityFunctions.h"
 #include "Timing.h"
 #include "PHExport.h"
-
+#include "PHCubical.h"
+#include "ResultWriter.h"
+#include "MeshExport.h"
+#include "MeshSimplify.h"
+#include "ContourSimplify.h"
+#include "MeshOptimize.h"
+
+#include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 using namespace nlohmann;
@@ -27,17 +36,28 @@ unsigned long stats;
 unsigned long export_io;
 
 bool ph_toggle;
+bool ph_binary;
 string ph_points_path;
 string ph_tets_path;
+bool ph_simplify;
+float ph_threshold;
+string ph_vineyard_path;
 int wid_buffer;
 int num_ransac;
+unsigned ransac_seed;
+float ransac_confidence;
+string lattice_cache_path;
+string alignment_mode;
+bool alignment_clusters;
+int cap_stride;
 
 // Mode 0: ./st-visualizer 0 <config.json file path>
 // Mode 1: ./st-visualizer 1 <config.json file content>
+// Mode 2: ./st-visualizer 2 <image config.json file path>, persistent homology of an image
 int main(int argc, char *argv[])
 {
     json config;
-    if (strcmp(argv[1], "0") == 0)
+    if (strcmp(argv[1], "0") == 0 || strcmp(argv[1], "2") == 0)
     {
         ifstream file(argv[2]);
         if (file.is_open())
@@ -62,7 +82,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    string alignmentFile = config.at("alignmentFile").get<string>();
+    if (strcmp(argv[1], "2") == 0)
+    {
+        run_cubical_ph(config);
+        log("Exiting.");
+        return 0;
+    }
+
+    alignment_mode = config.value("alignment", string("file"));
+    alignment_clusters = config.value("alignmentClusters", false);
+    string alignmentFile = alignment_mode == "file" ? config.at("alignmentFile").get<string>() : string();
     string target = config.at("target").get<string>();
     float shrink = config.at("shrink").get<float>();
     vector<string> sliceNames;
@@ -80,12 +109,63 @@ int main(int argc, char *argv[])
     }
 
     ph_toggle = config.at("PHExport").get<bool>();
+    ph_binary = config.value("PHFormat", string("csv")) == "binary";
     ph_points_path = config.at("PHPoints").get<string>();
     ph_tets_path = config.at("PHTets").get<string>();
+    ph_simplify = config.value("PHSimplify", false);
+    ph_threshold = config.value("PHThreshold", 0.0f);
+    ph_vineyard_path = config.value("PHVineyard", string());
     wid_buffer = config.at("GrowWidth").get<int>();
     num_ransac = config.at("NumRansac").get<int>();
+    ransac_seed = config.value("seed", 0u);
+    ransac_confidence = config.value("RansacConfidence", 0.0f);
+    // caps on every other lattice row by default, 1 copies the whole first and last slice
+    cap_stride = config.value("capStride", 2);
+    lattice_cache_path = config.value("latticeCache", string());
+    const bool ph_2d = config.value("PH2D", false);
+    const string result_format = config.value("resultFormat", string("json"));
+    const bool render_buffers = config.value("renderBuffers", false);
+    const vector<float> lod_ratios = config.value("meshLODs", vector<float>());
+    for (const float ratio : lod_ratios)
+    {
+        if (!(ratio > 0 && ratio <= 1))
+        {
+            throw std::runtime_error("meshLODs ratios must be in (0, 1], got " + std::to_string(ratio));
+        }
+    }
+    const int result_lod = config.value("resultLOD", 0);
+    const int mesh_export_lod = config.value("meshExportLOD", 0);
+    // 0 is the full mesh, i picks the ith entry of meshLODs
+    if (result_lod < 0 || result_lod > static_cast<int>(lod_ratios.size()))
+    {
+        throw std::runtime_error("resultLOD must be in [0, " + std::to_string(lod_ratios.size()) + "], got " + std::to_string(result_lod));
+    }
+    if (mesh_export_lod < 0 || mesh_export_lod > static_cast<int>(lod_ratios.size()))
+    {
+        throw std::runtime_error("meshExportLOD must be in [0, " + std::to_string(lod_ratios.size()) + "], got " + std::to_string(mesh_export_lod));
+    }
+    const bool mesh_meshlets = config.value("meshlets", false);
+    const bool mesh_optimize = config.value("meshOptimize", false) || mesh_meshlets;
+    const vector<float> contour_lod_tolerances = config.value("contourLODs", vector<float>());
+    const string contour_simplify = config.value("contourSimplify", string("dp"));
+    const int result_contour_lod = config.value("resultContourLOD", 0);
+    for (const float tolerance : contour_lod_tolerances)
+    {
+        if (!(tolerance >= 0))
+        {
+            throw std::runtime_error("contourLODs tolerances must be non-negative, got " + std::to_string(tolerance));
+        }
+    }
+    // 0 is the full contours, i picks the ith entry of contourLODs
+    if (result_contour_lod < 0 || result_contour_lod > static_cast<int>(contour_lod_tolerances.size()))
+    {
+        throw std::runtime_error("resultContourLOD must be in [0, " + std::to_string(contour_lod_tolerances.size()) + "], got " + std::to_string(result_contour_lod));
+    }
+    const bool lattice_triangulation = config.value("latticeTriangulation", false);
+    const bool result_chunked = config.at("resultExport").get<bool>() && result_format == "chunked";
 
-    const vector<pair<vector<coord>, vector<coord>>> alignmentValues = importAlignments(alignmentFile);
+    const vector<pair<vector<coord>, vector<coord>>> alignmentValues =
+        alignment_mode == "file" ? importAlignments(alignmentFile) : vector<pair<vector<coord>, vector<coord>>>();
 
     const tsv_return_type results = loadTsv(
         config.at("fileName").get<std::string>(),
@@ -99,115 +179,118 @@ int main(int argc, char *argv[])
         alignmentValues);
 
     std::chrono::steady_clock::time_point start_contour_2d = std::chrono::high_resolution_clock::now();
-    auto [ctrs2dVals, tris2dVals] = getSectionContoursAll(results.slices, results.values, shrink);
-    auto [ctrs2dclusters, tris2dclusters] = getSectionContoursAll(results.slices, results.clusters, shrink);
+    vector<vector<vector<int>>> sectionTris;
+    vector<sectionContour> sectionContoursVals;
+    vector<sectionContour> sectionContoursClusters;
+    const bool need_section_contours = !contour_lod_tolerances.empty();
+    const auto *lattices = lattice_triangulation ? &results.lattices : nullptr;
+    auto [ctrs2dVals, tris2dVals] = getSectionContoursAll(results.slices, results.values, results.valueArgmax, shrink, &sectionTris,
+                                                          need_section_contours ? &sectionContoursVals : nullptr, lattices);
+    auto [ctrs2dclusters, tris2dclusters] = getSectionContoursAll(results.slices, results.clusters, results.clusterArgmax, shrink, nullptr,
+                                                                  need_section_contours ? &sectionContoursClusters : nullptr, lattices);
+
+    // levels of detail 1.. of the section contours, level 0 is the full contour
+    vector<decltype(ctrs2dVals)> contourLodVals;
+    vector<decltype(ctrs2dclusters)> contourLodClusters;
+    if (need_section_contours)
+    {
+        log("Simplifying contours.");
+        contourLodVals = getSectionContourLODs(sectionContoursVals, contour_lod_tolerances, contour_simplify, shrink);
+        contourLodClusters = getSectionContourLODs(sectionContoursClusters, contour_lod_tolerances, contour_simplify, shrink);
+    }
+    const auto &resultCtrs2dVals = result_contour_lod == 0 ? ctrs2dVals : contourLodVals.at(result_contour_lod - 1);
+    const auto &resultCtrs2dClusters = result_contour_lod == 0 ? ctrs2dclusters : contourLodClusters.at(result_contour_lod - 1);
+    // each slice holds a list of [dimension, birth, death] per material
+    vector<vector<vector<tuple<int, float, float>>>> ph2dEntries;
+    if (ph_2d)
+    {
+        ph2dEntries = get_sections_ph_entries(compute_sections_ph(results.values, results.valueArgmax, sectionTris));
+    }
     std::chrono::steady_clock::time_point end_contour_2d = std::chrono::high_resolution_clock::now();
     contour_2d = duration_cast<std::chrono::microseconds>(end_contour_2d - start_contour_2d).count();
 
+    // chunks of finished stages are written in the background while the next stage runs
+    vector<std::future<void>> chunk_writes;
+    if (result_chunked)
+    {
+        chunk_writes.push_back(std::async(std::launch::async, writeSliceChunks, std::cref(target),
+                                          std::cref(results.slices), std::cref(results.values), std::cref(results.clusters),
+                                          std::cref(resultCtrs2dVals), std::cref(tris2dVals),
+                                          std::cref(resultCtrs2dClusters), std::cref(tris2dclusters)));
+    }
+
     std::chrono::steady_clock::time_point start_contour_3d = std::chrono::high_resolution_clock::now();
     auto allpts = concatMatrixes(results.slices);
-    auto ctrs3dVals = getVolumeContours(allpts, flatten<std::vector<float>>(results.values), shrink, true);
-    auto ctrs3dClusters = getVolumeContours(allpts, flatten<std::vector<float>>(results.clusters), shrink, false);
-    auto ptClusIndex = mapVector(results.clusters, std::function(
-                                                       [](const std::vector<std::vector<float>> &layer, size_t)
-                                                       {
-                                                           return mapVector(layer, std::function(getMaxPos));
-                                                       }));
-    auto ptValIndex = mapVector(results.values, std::function([](const std::vector<std::vector<float>> &layer)
-                                                              { return mapVector(layer, std::function(getMaxPos)); }));
-    auto slices = mapVector(results.slices, std::function([](const Eigen::Matrix3Xf &layer)
-                                                          {
-                                                              std::vector<Eigen::Vector3f> temp;
-                                                              temp.reserve(layer.cols());
-                                                              for (const auto &pt: layer.colwise())
-                                                              {
-                                                                  temp.emplace_back(pt);
-                                                              }
-                                                              return temp; }));
-
-    auto convertCtrs = [](
-                           std::vector<std::vector<std::pair<
-                               std::vector<Eigen::Matrix<float, 3, 1, 0>>, std::vector<std::pair<int, int>>>>> &ctrs2dVals)
+    vector<renderMesh> renderVals;
+    vector<renderMesh> renderClusters;
+    // the decimation needs the neighbor materials from the render meshes
+    const bool need_render = render_buffers || !lod_ratios.empty();
+    auto ctrs3dVals = getVolumeContours(allpts, flatten<std::vector<float>>(results.values), concatArgmax(results.valueArgmax),
+                                        shrink, true, need_render ? &renderVals : nullptr);
+    auto ctrs3dClusters = getVolumeContours(allpts, flatten<std::vector<float>>(results.clusters), concatArgmax(results.clusterArgmax),
+                                            shrink, false, need_render ? &renderClusters : nullptr);
+
+    // levels of detail 1.. of the 3D meshes, level 0 is the full mesh, which the stats always use
+    vector<decltype(ctrs3dVals)> lodVals;
+    vector<decltype(ctrs3dClusters)> lodClusters;
+    vector<vector<vector<int>>> lodNeighborsVals;
+    vector<vector<vector<int>>> lodNeighborsClusters;
+    if (!lod_ratios.empty())
     {
-        json ctrs2dValsJson = json::array();
-        for (auto &ctrSlice : ctrs2dVals)
+        log("Decimating meshes.");
+        std::tie(lodVals, lodNeighborsVals) = getMeshLODs(ctrs3dVals, renderVals, lod_ratios);
+        std::tie(lodClusters, lodNeighborsClusters) = getMeshLODs(ctrs3dClusters, renderClusters, lod_ratios);
+    }
+    auto &resultVals = result_lod == 0 ? ctrs3dVals : lodVals.at(result_lod - 1);
+    auto &resultClusters = result_lod == 0 ? ctrs3dClusters : lodClusters.at(result_lod - 1);
+    auto &exportVals = mesh_export_lod == 0 ? ctrs3dVals : lodVals.at(mesh_export_lod - 1);
+    auto &exportClusters = mesh_export_lod == 0 ? ctrs3dClusters : lodClusters.at(mesh_export_lod - 1);
+    if (render_buffers && result_lod != 0)
+    {
+        for (size_t i = 0; i < resultVals.size(); i++)
         {
-            json ctrJson = json::array();
-            for (auto &ctr : ctrSlice)
-            {
-                json temp = json::array();
-                temp.push_back(ctr.first);
-                for (auto &i : ctr.second)
-                {
-                    // i.first++;
-                    // i.second++;
-                }
-                temp.push_back(ctr.second);
-                ctrJson.push_back(temp);
-            }
-
-            ctrs2dValsJson.push_back(ctrJson);
+            renderVals[i] = getRenderMesh(resultVals[i], lodNeighborsVals[result_lod - 1][i]);
         }
-
-        return ctrs2dValsJson;
-    };
-
-    auto convertTris = [](std::vector<std::tuple<
-                              std::vector<Eigen::Matrix<float, 3, 1, 0>>,
-                              std::vector<std::vector<int>>,
-                              std::vector<int>>> &tris2dVals)
-    {
-        json tris2dValsJson = json::array();
-        for (auto &tris : tris2dVals)
+        for (size_t i = 0; i < resultClusters.size(); i++)
         {
-            json a = json::array();
-            
-            json b = json::array();
-            for (auto &elem : std::get<0>(tris))
-            {
-                b.push_back(std::vector(elem.data(), elem.data() + elem.rows()));
-            }
-            a.push_back(b);
-
-            auto &triangles = std::get<1>(tris);
-            a.push_back(triangles);
-
-            auto &materials = std::get<2>(tris);
-            a.push_back(materials);
-
-            tris2dValsJson.push_back(a);
+            renderClusters[i] = getRenderMesh(resultClusters[i], lodNeighborsClusters[result_lod - 1][i]);
         }
+    }
 
-        return tris2dValsJson;
-    };
-
-    auto convert3D = [](
-                         std::vector<std::pair<std::vector<Eigen::Vector3f>, std::vector<std::vector<int>>>> &ctrs3d)
+    // vertex cache order of the meshes that are written out, which changes the stats only by rounding
+    vector<vector<meshlet>> meshletsVals;
+    vector<vector<meshlet>> meshletsClusters;
+    if (mesh_optimize)
     {
-        json ctrs3dJson = json::array();
-        for (auto &ctr : ctrs3d)
+        log("Optimizing mesh order.");
+        optimizeMeshes(resultVals, render_buffers ? &renderVals : nullptr, mesh_meshlets ? &meshletsVals : nullptr);
+        optimizeMeshes(resultClusters, render_buffers ? &renderClusters : nullptr,
+                       mesh_meshlets ? &meshletsClusters : nullptr);
+        if (mesh_export_lod != result_lod)
         {
-            json a = json::array();
-
-            a.push_back(ctr.first);
-            auto &segs = ctr.second;
-            for (auto &a : segs)
-            {
-                for (auto &b : a)
-                {
-                    // b++;
-                }
-            }
-            a.push_back(segs);
-
-            ctrs3dJson.push_back(a);
+            optimizeMeshes(exportVals);
+            optimizeMeshes(exportClusters);
         }
-
-        return ctrs3dJson;
-    };
+    }
+    auto ptClusIndex = mapVector(results.clusterArgmax, std::function([](const materialArgmax &layer)
+                                                                      { return layer.primary; }));
+    auto ptValIndex = mapVector(results.valueArgmax, std::function([](const materialArgmax &layer)
+                                                                    { return layer.primary; }));
     std::chrono::steady_clock::time_point end_contour_3d = std::chrono::high_resolution_clock::now();
     contour_3d = duration_cast<std::chrono::microseconds>(end_contour_3d - start_contour_3d).count();
 
+    if (result_chunked)
+    {
+        chunk_writes.push_back(std::async(std::launch::async, writeMaterialChunks, std::cref(target),
+                                          string("values"), std::cref(resultVals),
+                                          render_buffers ? &renderVals : nullptr,
+                                          mesh_meshlets ? &meshletsVals : nullptr));
+        chunk_writes.push_back(std::async(std::launch::async, writeMaterialChunks, std::cref(target),
+                                          string("clusters"), std::cref(resultClusters),
+                                          render_buffers ? &renderClusters : nullptr,
+                                          mesh_meshlets ? &meshletsClusters : nullptr));
+    }
+
     std::chrono::steady_clock::time_point start_stats = std::chrono::high_resolution_clock::now();
     vector<float> surface_area_features = computeSurfaceArea(ctrs3dVals);
     vector<float> surface_area_clusters = computeSurfaceArea(ctrs3dClusters);
@@ -219,49 +302,189 @@ int main(int argc, char *argv[])
     stats = duration_cast<std::chrono::microseconds>(end_stats - start_stats).count();
 
     std::chrono::steady_clock::time_point start_export_io = std::chrono::high_resolution_clock::now();
-    json ret = json::object();
-    ret["nat"] = results.values[0][0].size(); // nMat,
-    ret["shrink"] = shrink;                   // shrink,
-    ret["clusters"] = results.clusters;       // clusters,
-    ret["slices"] = slices;                   // slices,
-    ret["sliceNames"] = sliceNames;           // sliceNames
-    ret["values"] = results.values;
-    ret["featureNames"] = results.names;                 // featureNames,
-    ret["featureCols"] = featureCols;                    // featureCols,
-    ret["ptValIndex"] = ptValIndex;                      // ptValIndex,
-    ret["ctrs2Dvals"] = convertCtrs(ctrs2dVals);         // ctrs2Dvals,
-    ret["tris2Dvals"] = convertTris(tris2dVals);         // tris2Dvals
-    ret["ctrs3Dvals"] = convert3D(ctrs3dVals);           // ctrs3Dvals,
-    ret["ptClusIndex"] = ptClusIndex;                    // ptClusIndex,
-    ret["nClusters"] = results.clusters[0][0].size();    // nClusters,
-    ret["ctrs2Dclusters"] = convertCtrs(ctrs2dclusters); // ctrs2Dclusters,
-    ret["tris2Dclusters"] = convertTris(tris2dclusters); // tris2Dclusters,
-    ret["ctrs3Dclusters"] = convert3D(ctrs3dClusters);   // ctrs3Dclusters,
-                                                         //    ret["ctrsVolumeClusters"] = getVolumes(ctrs3dClusters);
-
     if (config.at("objExport").get<bool>())
     {
-        log("Exporting obj files.");
-        exportObj(config.at("featureObj").get<string>(), ctrs3dVals, results.names);
-        exportObj(config.at("clusterObj").get<string>(), ctrs3dClusters, results.clusterNames);
+        const string mesh_format = config.value("meshFormat", string("obj"));
+        const bool check_orientation = config.value("meshCheckOrientation", false);
+        log("Exporting ", mesh_format, " files.");
+        exportMeshes(config.at("featureObj").get<string>(), exportVals, results.names, mesh_format, check_orientation);
+        exportMeshes(config.at("clusterObj").get<string>(), exportClusters, results.clusterNames, mesh_format, check_orientation);
     }
 
-    ret["ctrsSurfaceAreaVals"] = surface_area_features;
-    ret["ctrsSurfaceAreaClusters"] = surface_area_clusters;
-    ret["ctrsVolumeVals"] = volume_features;
-    ret["ctrsVolumeClusters"] = volume_clusters;
-    ret["componentsVals"] = componentsVals;
-    ret["componentsClusters"] = componentsClusters;
-    ret["handlesVals"] = handlesVals;
-    ret["handlesClusters"] = handlesClusters;
-
     log("Calculations complete.");
 
-    if (config.at("resultExport").get<bool>())
+    // one flat triangle index buffer / list of vertex normals per material
+    auto writeRender = [](JsonWriter &f, const string &key, const vector<renderMesh> &meshes, auto member)
     {
-        log("Complete. Writing to file.");
+        f.key(key);
+        f.beginArray();
+        for (const renderMesh &mesh : meshes)
+        {
+            f.write(mesh.*member);
+        }
+        f.endArray();
+    };
+
+    // one list of (triangleOffset, triangleCount, min, max) per material
+    auto writeMeshlets = [](JsonWriter &f, const string &key, const vector<vector<meshlet>> &meshlets)
+    {
+        f.key(key);
+        f.beginArray();
+        for (const auto &material : meshlets)
+        {
+            f.beginArray();
+            for (const meshlet &m : material)
+            {
+                f.write(std::make_tuple(m.triangleOffset, m.triangleCount, m.min, m.max));
+            }
+            f.endArray();
+        }
+        f.endArray();
+    };
+
+
+    if (config.at("resultExport").get<bool>() && result_format == "binary")
+    {
+        log("Complete. Writing binary result to file.");
+        // the manifest holds the small fields, the large arrays go to <target>.bin as typed arrays
+        const string blob_path = target + ".bin";
+        BlobWriter blob(blob_path, config.value("geometryEncoding", string("float")) == "quantized");
+        json manifest = json::object();
+        manifest["format"] = "st-visualizer-binary";
+        manifest["version"] = 1;
+        manifest["compact"] = blob.compact;
+        manifest["blob"] = std::filesystem::path(blob_path).filename().string();
+        manifest["nat"] = results.values[0][0].size();
+        manifest["nClusters"] = results.clusters[0][0].size();
+        manifest["shrink"] = shrink;
+        manifest["sliceNames"] = sliceNames;
+        manifest["featureNames"] = results.names;
+        manifest["featureCols"] = featureCols;
+        manifest["slices"] = addPoints(blob, results.slices);
+        manifest["values"] = addPointValues(blob, results.values);
+        manifest["clusters"] = addPointValues(blob, results.clusters);
+        manifest["ptValIndex"] = addPointMaterials(blob, ptValIndex, results.values[0][0].size());
+        manifest["ptClusIndex"] = addPointMaterials(blob, ptClusIndex, results.clusters[0][0].size());
+        manifest["ctrs2Dvals"] = addContours2D(blob, resultCtrs2dVals);
+        manifest["ctrs2Dclusters"] = addContours2D(blob, resultCtrs2dClusters);
+        manifest["tris2Dvals"] = addTriangles2D(blob, tris2dVals, results.values[0][0].size());
+        manifest["tris2Dclusters"] = addTriangles2D(blob, tris2dclusters, results.clusters[0][0].size());
+        manifest["ctrs3Dvals"] = addContours3D(blob, resultVals, render_buffers ? &renderVals : nullptr);
+        manifest["ctrs3Dclusters"] = addContours3D(blob, resultClusters, render_buffers ? &renderClusters : nullptr);
+        if (mesh_meshlets)
+        {
+            manifest["meshlets3Dvals"] = addMeshlets(blob, meshletsVals);
+            manifest["meshlets3Dclusters"] = addMeshlets(blob, meshletsClusters);
+        }
+        if (ph_2d)
+        {
+            manifest["ph2Dvals"] = ph2dEntries;
+        }
+        manifest["ctrsSurfaceAreaVals"] = surface_area_features;
+        manifest["ctrsSurfaceAreaClusters"] = surface_area_clusters;
+        manifest["ctrsVolumeVals"] = volume_features;
+        manifest["ctrsVolumeClusters"] = volume_clusters;
+        manifest["componentsVals"] = componentsVals;
+        manifest["componentsClusters"] = componentsClusters;
+        manifest["handlesVals"] = handlesVals;
+        manifest["handlesClusters"] = handlesClusters;
+
         std::ofstream f(target);
-        f << ret;
+        f << manifest;
+    }
+    else if (result_chunked)
+    {
+        log("Complete. Writing chunk index to file.");
+        for (auto &chunk_write : chunk_writes)
+        {
+            chunk_write.get();
+        }
+
+        JsonWriter f(target);
+        f.beginObject();
+        f.key("chunks");
+        f.beginObject();
+        f.field("ctrs3Dclusters", getMaterialChunkNames(target, "clusters", ctrs3dClusters.size()));
+        f.field("ctrs3Dvals", getMaterialChunkNames(target, "values", ctrs3dVals.size()));
+        f.field("slices", getSliceChunkNames(target, results.slices.size()));
+        f.endObject();
+        f.field("componentsClusters", componentsClusters);
+        f.field("componentsVals", componentsVals);
+        f.field("ctrsSurfaceAreaClusters", surface_area_clusters);
+        f.field("ctrsSurfaceAreaVals", surface_area_features);
+        f.field("ctrsVolumeClusters", volume_clusters);
+        f.field("ctrsVolumeVals", volume_features);
+        f.field("featureCols", featureCols);
+        f.field("featureNames", results.names);
+        f.field("format", string("st-visualizer-chunked"));
+        f.field("handlesClusters", handlesClusters);
+        f.field("handlesVals", handlesVals);
+        f.field("nClusters", results.clusters[0][0].size());
+        f.field("nat", results.values[0][0].size());
+        if (ph_2d)
+        {
+            f.field("ph2Dvals", ph2dEntries);
+        }
+        f.field("ptClusIndex", ptClusIndex);
+        f.field("ptValIndex", ptValIndex);
+        f.field("shrink", shrink);
+        f.field("sliceNames", sliceNames);
+        f.field("version", 1);
+        f.endObject();
+        f.close();
+    }
+    else if (config.at("resultExport").get<bool>())
+    {
+        log("Complete. Writing to file.");
+        // keys in the order nlohmann::json sorts them, so the file matches the old DOM based output
+        JsonWriter f(target);
+        f.beginObject();
+        f.field("clusters", results.clusters);
+        f.field("componentsClusters", componentsClusters);
+        f.field("componentsVals", componentsVals);
+        f.field("ctrs2Dclusters", resultCtrs2dClusters);
+        f.field("ctrs2Dvals", resultCtrs2dVals);
+        f.field("ctrs3Dclusters", resultClusters);
+        f.field("ctrs3Dvals", resultVals);
+        f.field("ctrsSurfaceAreaClusters", surface_area_clusters);
+        f.field("ctrsSurfaceAreaVals", surface_area_features);
+        f.field("ctrsVolumeClusters", volume_clusters);
+        f.field("ctrsVolumeVals", volume_features);
+        f.field("featureCols", featureCols);
+        f.field("featureNames", results.names);
+        f.field("handlesClusters", handlesClusters);
+        f.field("handlesVals", handlesVals);
+        if (render_buffers)
+        {
+            writeRender(f, "indices3Dclusters", renderClusters, &renderMesh::indices);
+            writeRender(f, "indices3Dvals", renderVals, &renderMesh::indices);
+        }
+        if (mesh_meshlets)
+        {
+            writeMeshlets(f, "meshlets3Dclusters", meshletsClusters);
+            writeMeshlets(f, "meshlets3Dvals", meshletsVals);
+        }
+        f.field("nClusters", results.clusters[0][0].size());
+        f.field("nat", results.values[0][0].size());
+        if (render_buffers)
+        {
+            writeRender(f, "normals3Dclusters", renderClusters, &renderMesh::normals);
+            writeRender(f, "normals3Dvals", renderVals, &renderMesh::normals);
+        }
+        if (ph_2d)
+        {
+            f.field("ph2Dvals", ph2dEntries);
+        }
+        f.field("ptClusIndex", ptClusIndex);
+        f.field("ptValIndex", ptValIndex);
+        f.field("shrink", shrink);
+        f.field("sliceNames", sliceNames);
+        f.field("slices", results.slices);
+        f.field("tris2Dclusters", tris2dclusters);
+        f.field("tris2Dvals", tris2dVals);
+        f.field("values", results.values);
+        f.endObject();
+        f.close();
     }
     std::chrono::steady_clock::time_point end_export_io = std::chrono::high_resolution_clock::now();
     export_io = duration_cast<std::chrono::microseconds>(end_export_io - start_export_io).count();